@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hackasm.h"
+
+#define DEFAULT_INSTRUCTIONS 2000000
+#define NUM_RUNS 5
+#define MAX_LINE 32
+#define LABEL_EVERY 16
+#define NUM_VARIABLES 64
+
+// Generates a synthetic program and times hackasm_assemble on it. The
+// program mixes numeric, label and variable A-instructions with every comp,
+// dest and jump mnemonic, one label every LABEL_EVERY lines. With a file
+// name the program is written there instead, for timing hack_assembler
+// itself:
+//   bench_assembler [instructions] [out.asm]
+
+static const char *const comps[] = {
+  "0", "1", "-1", "D", "A", "M", "!D", "!A", "!M", "-D", "-A", "-M", "D+1",
+  "A+1", "M+1", "D-1", "A-1", "M-1", "D+A", "D+M", "D-A", "D-M", "A-D", "M-D",
+  "D&A", "D&M", "D|A", "D|M"
+};
+static const char *const dests[] = {
+  "", "M=", "D=", "MD=", "A=", "AM=", "AD=", "AMD="
+};
+static const char *const jumps[] = {
+  "", ";JGT", ";JEQ", ";JGE", ";JLT", ";JNE", ";JLE", ";JMP"
+};
+
+static char *generate(unsigned num_instructions, size_t *size);
+static unsigned next_random(unsigned *state);
+static double now(void);
+
+int main(int argc, char *argv[]) {
+  unsigned num_instructions = argc > 1 ? (unsigned) atoi(argv[1])
+      : DEFAULT_INSTRUCTIONS;
+  size_t size;
+  char *text = generate(num_instructions, &size);
+  if (argc > 2) {
+    FILE *asm_file = fopen(argv[2], "w");
+    if (asm_file == NULL) {
+      fprintf(stderr, "file not found: %s\n", argv[2]);
+      exit(EXIT_FAILURE);
+    }
+    fwrite(text, 1, size, asm_file);
+    fclose(asm_file);
+    free(text);
+    return EXIT_SUCCESS;
+  }
+
+  hackasm_context *ctx = hackasm_new();
+  if (ctx == NULL) {
+    fprintf(stderr, "malloc error\n");
+    exit(EXIT_FAILURE);
+  }
+  double best = 0;
+  for (int run = 0; run < NUM_RUNS; run++) {
+    double start = now();
+    if (hackasm_assemble(ctx, text, size) != HACKASM_OK) {
+      fprintf(stderr, "%s\n", hackasm_error(ctx));
+      exit(EXIT_FAILURE);
+    }
+    double elapsed = now() - start;
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+    }
+  }
+  printf("%u instructions in %.3f s (best of %d), %.2fM instructions/s\n",
+      num_instructions, best, NUM_RUNS, num_instructions / best / 1e6);
+  hackasm_free(ctx);
+  free(text);
+  return EXIT_SUCCESS;
+}
+
+static char *generate(unsigned num_instructions, size_t *size) {
+  size_t capacity = (size_t) num_instructions * MAX_LINE
+      + (num_instructions / LABEL_EVERY + 1) * MAX_LINE;
+  char *text = malloc(capacity);
+  if (text == NULL) {
+    fprintf(stderr, "malloc error\n");
+    exit(EXIT_FAILURE);
+  }
+  unsigned num_comps = sizeof(comps) / sizeof(comps[0]);
+  unsigned num_labels = num_instructions / LABEL_EVERY + 1;
+  unsigned state = 1;
+  size_t len = 0;
+  for (unsigned i = 0; i < num_instructions; i++) {
+    if (i % LABEL_EVERY == 0) {
+      len += sprintf(text + len, "(L%u)\n", i / LABEL_EVERY);
+    }
+    unsigned r = next_random(&state);
+    if (i % 2 == 0) {
+      // labels may be used before they are defined, like jumps forward
+      switch (r % 3) {
+        case 0:
+          len += sprintf(text + len, "@%u\n", r % 32768);
+          break;
+        case 1:
+          len += sprintf(text + len, "@L%u\n", r % num_labels);
+          break;
+        default:
+          len += sprintf(text + len, "@var%u\n", r % NUM_VARIABLES);
+          break;
+      }
+    } else {
+      len += sprintf(text + len, "%s%s%s\n", dests[r % 8],
+          comps[(r >> 3) % num_comps], jumps[(r >> 8) % 8]);
+    }
+  }
+  *size = len;
+  return text;
+}
+
+// fixed-seed linear congruential generator, so every run times one program
+static unsigned next_random(unsigned *state) {
+  *state = *state * 1103515245 + 12345;
+  return *state >> 8;
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hackasm.h"
+#include "parser.h"
+#include "peephole.h"
+#include "program.h"
+
+struct hackasm_context {
+  program prog;
+  bool has_program;
+  char error[PROGRAM_ERROR_LEN];
+};
+
+static hackasm_status fail(hackasm_context *ctx);
+
+hackasm_context *hackasm_new(void) {
+  return (hackasm_context *) calloc(1, sizeof(hackasm_context));
+}
+
+void hackasm_free(hackasm_context *ctx) {
+  if (ctx->has_program) {
+    program_free(&ctx->prog);
+  }
+  free(ctx);
+}
+
+hackasm_status hackasm_assemble(hackasm_context *ctx, const char *text,
+    size_t size) {
+  if (ctx->has_program) {
+    program_free(&ctx->prog);
+  }
+  ctx->has_program = true;
+  asm_source source;
+  source_from_buffer(&source, text, size);
+  bool assembled = program_init(&ctx->prog)
+      && program_assemble(&ctx->prog, &source);
+  source_close(&source);
+  if (!assembled) {
+    hackasm_status status = fail(ctx);
+    program_free(&ctx->prog);
+    ctx->has_program = false;
+    return status;
+  }
+  return HACKASM_OK;
+}
+
+hackasm_status hackasm_optimize(hackasm_context *ctx, unsigned *num_removed) {
+  *num_removed = 0;
+  if (ctx->has_program && !peephole_optimize(&ctx->prog, num_removed)) {
+    return fail(ctx);
+  }
+  return HACKASM_OK;
+}
+
+const uint16_t *hackasm_words(const hackasm_context *ctx,
+    unsigned *num_words) {
+  *num_words = ctx->has_program ? ctx->prog.num_words : 0;
+  return ctx->has_program ? ctx->prog.words : NULL;
+}
+
+const char *hackasm_error(const hackasm_context *ctx) {
+  return ctx->error;
+}
+
+// keeps the program's message in the context, where it outlives the program
+static hackasm_status fail(hackasm_context *ctx) {
+  memcpy(ctx->error, ctx->prog.error, PROGRAM_ERROR_LEN);
+  return HACKASM_ERROR;
+}
@@ -0,0 +1,40 @@
+#ifndef HACKASM_H
+#define HACKASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Assembles Hack programs held in memory, for callers that would rather link
+// against the assembler than run it once per program. A context holds one
+// program at a time and shares nothing with other contexts, so each thread
+// can use its own. Nothing here prints or exits: a call that fails returns
+// HACKASM_ERROR and hackasm_error describes why.
+typedef struct hackasm_context hackasm_context;
+
+typedef enum {
+  HACKASM_OK,
+  HACKASM_ERROR  // invalid instruction, or out of memory
+} hackasm_status;
+
+// Returns NULL if memory runs out
+hackasm_context *hackasm_new(void);
+void hackasm_free(hackasm_context *ctx);
+
+// Assembles size bytes of .asm text, replacing the previous program. On
+// failure the context holds no program.
+hackasm_status hackasm_assemble(hackasm_context *ctx, const char *text,
+    size_t size);
+
+// Runs the peephole pass over the current program and sets num_removed to
+// the number of instructions removed. On failure the program is unchanged.
+hackasm_status hackasm_optimize(hackasm_context *ctx, unsigned *num_removed);
+
+// The returned words belong to the context and stay valid until the next
+// call on it.
+const uint16_t *hackasm_words(const hackasm_context *ctx,
+    unsigned *num_words);
+
+// Message for the last call that failed, or "" if none has
+const char *hackasm_error(const hackasm_context *ctx);
+
+#endif
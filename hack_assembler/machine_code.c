@@ -1,173 +1,141 @@
 #include <ctype.h>
-#include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
 #include "machine_code.h"
-#include "symbol_table.h"
 
-#define MODE                   3
-#define COMP_START             4
-#define COMP_INSTRUCTION_LEN   6
-#define DEST_A                10
-#define DEST_D                11
-#define DEST_M                12
-#define JUMP_START            13
-#define JUMP_INSTRUCTION_LEN   3
-#define LOOKUP_COLS_PER_ENTRY  2
-#define ASM_COL                0
-#define HACK_COL               1
-#define STACK_START           16
+#define C_INSTRUCTION 0xE000
+#define COMP_SHIFT    6
+#define DEST_SHIFT    3
+#define DEST_A        0x4
+#define DEST_D        0x2
+#define DEST_M        0x1
+#define KEY_CHARS     3
+#define INVALID_KEY   0xFFFFFFFF
 
-bool is_number(char *label);
-void remove_spaces(char *instruction);
-void init_c_instruction(char *instruction);
-void get_dest_instruction(char *dest, char *asm_line);
-void get_comp_instruction(char *comp, char *asm_line);
-void get_jump_instruction(char *jump, char *asm_line);
+// Mnemonics of up to KEY_CHARS characters are packed into an integer so each
+// field is decoded by a single switch instead of a strcmp search.
+#define KEY(a, b, c) ((unsigned) (a) | (unsigned) (b) << 8 | (unsigned) (c) << 16)
 
-void get_a_instruction(char *asm_line, char *instruction) {
-  char *label = strchr(asm_line, '@') + 1;
-  int address;
-  if (is_number(label)) {
-    address = atoi(label);
-  } else if (symbol_table_contains(label)) {
-    address = symbol_table_get(label);
-  } else {
-    static int next_var_addr = STACK_START;
-    symbol_table_add(label, next_var_addr);
-    address = next_var_addr++;
-  }
-  int i = COMMAND_LEN;
-  instruction[--i] = '\0';
-  while (i > 0) {
-    instruction[--i] = '0' + (address & 0x01);
-    address >>= 1;
-  }
-}
+static int get_comp_bits(unsigned comp_key);
+static int get_jump_bits(unsigned jump_key);
 
-bool is_number(char *label) {
-  char c;
-  while ((c = *label++) != '\0') {
-    if (!isdigit(c)) {
+bool is_number(line_view label) {
+  for (const char *p = label.start; p < label.end; p++) {
+    if (!isdigit((unsigned char) *p)) {
       return false;
     }
   }
   return true;
 }
 
-void get_c_instruction(char *asm_line, char *instruction) {
-  init_c_instruction(instruction);
-  char *dest, *comp, *jump;
-  char *p_semicolon = index(asm_line, ';');
-  if (p_semicolon != NULL) {
-    jump = p_semicolon + 1;
-    *p_semicolon = '\0';
-  } else {
-    jump = NULL;
-  }
-  char *p_equals = index(asm_line, '=');
-  if (p_equals != NULL) {
-    dest = asm_line;
-    comp = p_equals + 1;
-    *p_equals = '\0';
-  } else {
-    dest = NULL;
-    comp = asm_line;
+unsigned get_number(line_view label) {
+  unsigned number = 0;
+  for (const char *p = label.start; p < label.end; p++) {
+    number = number * 10 + (*p - '0');
   }
-  get_dest_instruction(dest, instruction);
-  get_comp_instruction(comp, instruction);
-  get_jump_instruction(jump, instruction);
+  return number;
 }
 
-void init_c_instruction(char *instruction) {
-  strcpy(instruction, "1110000000000000\0");
+void word_to_instruction(uint16_t word, char *instruction) {
+  int i = COMMAND_LEN;
+  instruction[--i] = '\0';
+  while (i > 0) {
+    instruction[--i] = '0' + (word & 0x01);
+    word >>= 1;
+  }
 }
 
-void get_dest_instruction(char *dest, char* instruction) {
-  if (dest == NULL) {
-    return;
-  }
-  if (strchr(dest, 'a')) {
-    *(instruction + DEST_A) = '1';
+// Decodes dest=comp;jump in one scan of asm_line. Characters are packed into
+// key as they are read; '=' turns the letters seen so far into dest bits and
+// ';' closes the comp field. Returns false if a field is not a valid mnemonic.
+bool get_c_instruction(line_view asm_line, uint16_t *word) {
+  unsigned key = 0, comp_key;
+  int key_len = 0, dest = 0, comp, jump = 0;
+  bool in_jump = false;
+  for (const char *p = asm_line.start; p < asm_line.end; p++) {
+    char c = *p;
+    if (isspace((unsigned char) c)) {
+      continue;
+    } else if (c == '=' && !in_jump) {
+      for (int i = 0; i < key_len; i++) {
+        char d = key >> (8 * i);
+        dest |= d == 'A' ? DEST_A : d == 'D' ? DEST_D : d == 'M' ? DEST_M : 0;
+      }
+      key = 0;
+      key_len = 0;
+    } else if (c == ';' && !in_jump) {
+      comp_key = key;
+      in_jump = true;
+      key = 0;
+      key_len = 0;
+    } else if (key_len < KEY_CHARS) {
+      key |= (unsigned) c << (8 * key_len++);
+    } else {
+      key = INVALID_KEY;
+    }
   }
-  if (strchr(dest, 'm')) {
-    *(instruction + DEST_M) = '1';
+  if (in_jump) {
+    jump = get_jump_bits(key);
+  } else {
+    comp_key = key;
   }
-  if (strchr(dest, 'd')) {
-    *(instruction + DEST_D) = '1';
+  comp = get_comp_bits(comp_key);
+  if (comp < 0 || jump < 0) {
+    return false;
   }
+  *word = C_INSTRUCTION | comp << COMP_SHIFT | dest << DEST_SHIFT | jump;
+  return true;
 }
 
-void get_comp_instruction(char *comp, char* instruction) {
-  static char *comp_lookup[][LOOKUP_COLS_PER_ENTRY] = {
-    { "0",   "101010"},
-    { "1",   "111111"},
-    { "-1",  "111010"},
-    { "d",   "001100"},
-    { "a",   "110000"},
-    { "m",   "110000"},
-    { "!d",  "001101"},
-    { "!a",  "110001"},
-    { "!m",  "110001"},
-    { "-d",  "001111"},
-    { "-a",  "110011"},
-    { "-m",  "110011"},
-    { "d+1", "011111"},
-    { "a+1", "110111"},
-    { "m+1", "110111"},
-    { "d-1", "001110"},
-    { "a-1", "110010"},
-    { "m-1", "110010"},
-    { "d+a", "000010"},
-    { "d+m", "000010"},
-    { "d-a", "010011"},
-    { "d-m", "010011"},
-    { "a-d", "000111"},
-    { "m-d", "000111"},
-    { "d&a", "000000"},
-    { "d&m", "000000"},
-    { "d|a", "010101"},
-    { "d|m", "010101"}
-  };
-
-  if (strchr(comp, 'm')) {
-    *(instruction + MODE) = '1';
+// returns the a bit followed by the six c bits, or -1 if comp is invalid
+static int get_comp_bits(unsigned comp_key) {
+  switch (comp_key) {
+    case KEY('0', 0, 0):     return 0x2A;  // 0 101010
+    case KEY('1', 0, 0):     return 0x3F;  // 0 111111
+    case KEY('-', '1', 0):   return 0x3A;  // 0 111010
+    case KEY('D', 0, 0):     return 0x0C;  // 0 001100
+    case KEY('A', 0, 0):     return 0x30;  // 0 110000
+    case KEY('M', 0, 0):     return 0x70;  // 1 110000
+    case KEY('!', 'D', 0):   return 0x0D;  // 0 001101
+    case KEY('!', 'A', 0):   return 0x31;  // 0 110001
+    case KEY('!', 'M', 0):   return 0x71;  // 1 110001
+    case KEY('-', 'D', 0):   return 0x0F;  // 0 001111
+    case KEY('-', 'A', 0):   return 0x33;  // 0 110011
+    case KEY('-', 'M', 0):   return 0x73;  // 1 110011
+    case KEY('D', '+', '1'): return 0x1F;  // 0 011111
+    case KEY('A', '+', '1'): return 0x37;  // 0 110111
+    case KEY('M', '+', '1'): return 0x77;  // 1 110111
+    case KEY('D', '-', '1'): return 0x0E;  // 0 001110
+    case KEY('A', '-', '1'): return 0x32;  // 0 110010
+    case KEY('M', '-', '1'): return 0x72;  // 1 110010
+    case KEY('D', '+', 'A'):
+    case KEY('A', '+', 'D'): return 0x02;  // 0 000010
+    case KEY('D', '+', 'M'):
+    case KEY('M', '+', 'D'): return 0x42;  // 1 000010
+    case KEY('D', '-', 'A'): return 0x13;  // 0 010011
+    case KEY('D', '-', 'M'): return 0x53;  // 1 010011
+    case KEY('A', '-', 'D'): return 0x07;  // 0 000111
+    case KEY('M', '-', 'D'): return 0x47;  // 1 000111
+    case KEY('D', '&', 'A'):
+    case KEY('A', '&', 'D'): return 0x00;  // 0 000000
+    case KEY('D', '&', 'M'):
+    case KEY('M', '&', 'D'): return 0x40;  // 1 000000
+    case KEY('D', '|', 'A'):
+    case KEY('A', '|', 'D'): return 0x15;  // 0 010101
+    case KEY('D', '|', 'M'):
+    case KEY('M', '|', 'D'): return 0x55;  // 1 010101
+    default:                 return -1;
   }
-  char *comp_instruction;
-  int num_entries = sizeof(comp_lookup) / sizeof(comp_lookup[0]);
-  for (int i = 0; i < num_entries; i ++) {
-    if (strcmp(comp, comp_lookup[i][ASM_COL]) == 0) {
-      comp_instruction = comp_lookup[i][HACK_COL];
-      break;
-    }
-  }
-  strncpy(instruction + COMP_START, comp_instruction, COMP_INSTRUCTION_LEN);
 }
 
-void get_jump_instruction(char *jump, char* instruction) {
-  static char *jump_lookup[][LOOKUP_COLS_PER_ENTRY] = {
-    { "",    "000"},
-    { "j_gT", "001"},
-    { "j_eQ", "010"},
-    { "j_gE", "011"},
-    { "j_lT", "100"},
-    { "j_nE", "101"},
-    { "j_lE", "110"},
-    { "j_mP", "111"}
-  };
-
-  char *jump_instruction;
-  if (jump == NULL) {
-    jump_instruction = "000";
-  } else {
-    int num_entries = sizeof(jump_lookup) / sizeof(jump_lookup[0]);
-    for (int i = 0; i < num_entries; i ++) {
-      if (strcmp(jump, jump_lookup[i][ASM_COL]) == 0) {
-        jump_instruction = jump_lookup[i][HACK_COL];
-        break;
-      }
-    }
+static int get_jump_bits(unsigned jump_key) {
+  switch (jump_key) {
+    case KEY('J', 'G', 'T'): return 1;
+    case KEY('J', 'E', 'Q'): return 2;
+    case KEY('J', 'G', 'E'): return 3;
+    case KEY('J', 'L', 'T'): return 4;
+    case KEY('J', 'N', 'E'): return 5;
+    case KEY('J', 'L', 'E'): return 6;
+    case KEY('J', 'M', 'P'): return 7;
+    default:                 return -1;
   }
-  strncpy(instruction + JUMP_START, jump_instruction, JUMP_INSTRUCTION_LEN);
 }
-
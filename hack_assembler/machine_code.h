@@ -1,5 +1,11 @@
-#define COMMAND_LEN 17 // 16 bit instruction + \0
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "parser.h"
 
-void get_a_instruction(char *asm_line, char *instruction);
-void get_c_instruction(char *asm_line, char *instruction);
+#define COMMAND_LEN 17 // 16 bit instruction + \0
 
+bool is_number(line_view label);
+unsigned get_number(line_view label);
+bool get_c_instruction(line_view asm_line, uint16_t *word);
+void word_to_instruction(uint16_t word, char *instruction);
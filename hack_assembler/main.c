@@ -1,86 +1,239 @@
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "parser.h"
-#include "machine_code.h"
+#include "peephole.h"
+#include "program.h"
 #include "symbol_table.h"
 
 #define ASM_EXTENSION_LEN 4
-#define BIN_EXTENSION_LEN 5
-#define MAX_LINE 100
+#define BIN_EXTENSION ".hack"
+#define ROM_EXTENSION ".rom"
+#define MAP_EXTENSION ".map"
+#define ROM_SIZE 32768
+#define STDIO_FILENAME "-"
 
-static char *get_bin_filename(char *asm_filename);
+// one input file and the context it is assembled in
+typedef struct {
+  char *asm_filename;
+  program prog;
+} assembly_job;
+
+static assembly_job *jobs;
+static int num_jobs;
+static int next_job;
+static pthread_mutex_t next_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool packed_output = false;
+static bool optimize = false;
+static bool write_map = false;
+static bool print_stats = false;
+
+static void *assembly_worker(void *unused);
+static void assemble_file(assembly_job *job);
+static void assembly_error(const assembly_job *job);
+static char *get_bin_filename(char *asm_filename, const char *extension);
 
 int main(int argc, char *argv[]) {
-  static char asm_line[MAX_LINE];
-  static char instruction[COMMAND_LEN];
-  static FILE *asm_file, *bin_file;
+  int num_workers = sysconf(_SC_NPROCESSORS_ONLN);
 
-  symbol_table_init();
+  int option;
+  while ((option = getopt(argc, argv, "bj:mOs")) != -1) {
+    switch (option) {
+      case 'b':  // write packed .rom images instead of .hack text
+        packed_output = true;
+        break;
+      case 'j':  // number of files to assemble concurrently
+        num_workers = atoi(optarg);
+        break;
+      case 'm':  // write a .map file of label and variable addresses
+        write_map = true;
+        break;
+      case 'O':  // run the peephole optimizer before writing the output
+        optimize = true;
+        break;
+      case 's':  // print symbol table probe statistics
+        print_stats = true;
+        break;
+      default:
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind >= argc) {  // argv[optind] = asm_filename ...
+    fprintf(stderr, "usage: hack_assembler [-b] [-j jobs] [-m] [-O] [-s] "
+        "file.asm ...\n");
+    fprintf(stderr, "       hack_assembler [-b] [-O] [-s] - < in.asm "
+        "> out.hack\n");
+    exit(EXIT_FAILURE);
+  }
 
-  if (argc < 2) {  // argv[0] = ./hack_assembler, argc[1] = asm_filename ...
-    printf("assembler takes at least one argument, the names of files to assemble ending in .asm\n");
+  num_jobs = argc - optind;
+  jobs = (assembly_job *) calloc(num_jobs, sizeof(assembly_job));
+  if (jobs == NULL) {
+    fprintf(stderr, "malloc error\n");
     exit(EXIT_FAILURE);
   }
-  for (int asm_file_index = 1; asm_file_index < argc; asm_file_index++) {
-    char *asm_filename = argv[asm_file_index];
-    if (strstr(asm_filename, ".asm") - asm_filename != strlen(asm_filename) - ASM_EXTENSION_LEN) {
-      printf("error: file to assemble must end in .asm\n");
+  for (int i = 0; i < num_jobs; i++) {
+    jobs[i].asm_filename = argv[optind + i];
+    // stdout can only carry one program
+    if (strcmp(jobs[i].asm_filename, STDIO_FILENAME) == 0 && num_jobs > 1) {
+      fprintf(stderr, "error: - cannot be combined with other files\n");
+      exit(EXIT_FAILURE);
+    }
+    if (strcmp(jobs[i].asm_filename, STDIO_FILENAME) == 0 && write_map) {
+      fprintf(stderr, "error: -m needs a file name to name the map after\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // every file gets its own symbol table and variable allocator, so the
+  // output does not depend on how files are spread over the workers
+  if (num_workers > num_jobs) {
+    num_workers = num_jobs;
+  }
+  if (num_workers <= 1) {
+    assembly_worker(NULL);
+  } else {
+    pthread_t workers[num_workers];
+    for (int i = 0; i < num_workers; i++) {
+      if (pthread_create(&workers[i], NULL, assembly_worker, NULL) != 0) {
+        fprintf(stderr, "error: could not start worker thread\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    for (int i = 0; i < num_workers; i++) {
+      pthread_join(workers[i], NULL);
+    }
+  }
+
+  if (print_stats) {
+    for (int i = 0; i < num_jobs; i++) {
+      fprintf(stderr, "%s: ", jobs[i].asm_filename);
+      symbol_table_print_stats(jobs[i].prog.symbols, stderr);
+      program_free(&jobs[i].prog);
+    }
+  }
+  free(jobs);
+
+  return (EXIT_SUCCESS);
+}
+
+static void *assembly_worker(void *unused) {
+  while (true) {
+    pthread_mutex_lock(&next_job_lock);
+    int job_index = next_job++;
+    pthread_mutex_unlock(&next_job_lock);
+    if (job_index >= num_jobs) {
+      return NULL;
+    }
+    assemble_file(&jobs[job_index]);
+  }
+}
+
+// "-" reads the program from stdin and writes it to stdout, so the
+// assembler can sit at the end of a pipeline without temporary files
+static void assemble_file(assembly_job *job) {
+  char *asm_filename = job->asm_filename;
+  bool use_stdio = strcmp(asm_filename, STDIO_FILENAME) == 0;
+  FILE *asm_file = stdin;
+  if (!use_stdio) {
+    char *p_extension = strstr(asm_filename, ".asm");
+    if (p_extension == NULL || p_extension - asm_filename
+        != strlen(asm_filename) - ASM_EXTENSION_LEN) {
+      fprintf(stderr, "error: file to assemble must end in .asm\n");
+      exit(EXIT_FAILURE);
     }
     asm_file = fopen(asm_filename, "r");
     if (asm_file == NULL) {
-      printf("file not found: %s\n", asm_filename);
+      fprintf(stderr, "file not found: %s\n", asm_filename);
       exit(EXIT_FAILURE);
     }
+  }
 
-    int line_num = 0;
-    while ((get_line(asm_line, MAX_LINE, asm_file)) != NULL) {
-      if (is_label(asm_line)) {
-        symbol_table_add(get_label(asm_line), line_num);
-      } else {
-        line_num++;
-      }
+  asm_source source;
+  if (!source_open(&source, asm_file)) {
+    fprintf(stderr, "malloc error\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!program_init(&job->prog)
+      || !program_assemble(&job->prog, &source)) {
+    assembly_error(job);
+  }
+  source_close(&source);
+  if (!use_stdio) {
+    fclose(asm_file);
+  }
+  if (optimize) {
+    unsigned original_len = job->prog.num_words;
+    unsigned saved;
+    if (!peephole_optimize(&job->prog, &saved)) {
+      assembly_error(job);
     }
+    fprintf(stderr, "%s: peephole pass saved %u of %u instructions, "
+        "%u words (ROM holds %d)\n", asm_filename, saved, original_len,
+        job->prog.num_words, ROM_SIZE);
+  }
 
-    char *bin_filename = get_bin_filename(asm_filename);
-    bin_file = fopen(bin_filename, "w");
+  FILE *bin_file = stdout;
+  if (!use_stdio) {
+    char *bin_filename = get_bin_filename(asm_filename,
+        packed_output ? ROM_EXTENSION : BIN_EXTENSION);
+    bin_file = fopen(bin_filename, packed_output ? "wb" : "w");
     if (bin_file == NULL) {
-      printf("file not found: %s\n", bin_filename);
+      fprintf(stderr, "file not found: %s\n", bin_filename);
       exit(EXIT_FAILURE);
     }
     free(bin_filename);
+  }
 
-    rewind(asm_file);
-    while ((get_line(asm_line, MAX_LINE, asm_file)) != NULL) {
-      if (is_a_command(asm_line)) {
-        get_a_instruction(asm_line, instruction);
-      } else if (is_label(asm_line)) {
-        continue;
-      } else {
-        get_c_instruction(asm_line, instruction);
-      }
-      fprintf(bin_file, "%s\n", instruction);
-    }
-
-    fclose(asm_file);
+  if (packed_output) {
+    program_write_binary(&job->prog, bin_file);
+  } else {
+    program_write(&job->prog, bin_file);
+  }
+  if (use_stdio) {
+    fflush(bin_file);
+  } else {
     fclose(bin_file);
   }
 
-  return (EXIT_SUCCESS);
+  if (write_map) {
+    char *map_filename = get_bin_filename(asm_filename, MAP_EXTENSION);
+    FILE *map_file = fopen(map_filename, "w");
+    if (map_file == NULL) {
+      fprintf(stderr, "file not found: %s\n", map_filename);
+      exit(EXIT_FAILURE);
+    }
+    free(map_filename);
+    if (!program_write_map(&job->prog, map_file)) {
+      assembly_error(job);
+    }
+    fclose(map_file);
+  }
+  if (!print_stats) {
+    program_free(&job->prog);
+  }
 }
 
-static char *get_bin_filename(char *asm_filename) {
+// the library only reports errors, so the executable stops here
+static void assembly_error(const assembly_job *job) {
+  fprintf(stderr, "%s: %s\n", job->asm_filename, job->prog.error);
+  exit(EXIT_FAILURE);
+}
+
+static char *get_bin_filename(char *asm_filename, const char *extension) {
   int bin_filename_len = strlen(asm_filename) - ASM_EXTENSION_LEN
-      + BIN_EXTENSION_LEN + 1;
+      + strlen(extension) + 1;
   char *bin_filename = (char *) malloc(bin_filename_len * sizeof(char));
   if (bin_filename == NULL) {
-    printf("malloc error\n");
+    fprintf(stderr, "malloc error\n");
     exit(EXIT_FAILURE);
   }
   strcpy(bin_filename, asm_filename);
   char *p_extension = strstr(bin_filename, ".asm");
-  strcpy(p_extension, ".hack");
+  strcpy(p_extension, extension);
   return bin_filename;
 }
-
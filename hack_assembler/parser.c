@@ -1,53 +1,121 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "parser.h"
 
-void remove_spaces(char *asm_line);
-void remove_comments(char *asm_line);
+#define READ_CHUNK 65536
 
-char *get_line(char *asm_line, int max_line, FILE *asm_file) {
-  do {
-    if (fgets(asm_line, max_line, asm_file) == NULL) {
-      return NULL;
-    } 
-    remove_comments(asm_line);
-    remove_spaces(asm_line);
-  } while (strlen(asm_line) == 0);
-  return asm_line;
+static bool read_source(asm_source *source, FILE *asm_file);
+static line_view trim(const char *start, const char *end);
+
+bool source_open(asm_source *source, FILE *asm_file) {
+  memset(source, 0, sizeof(asm_source));
+  struct stat file_stat;
+  int fd = fileno(asm_file);
+  if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode)
+      && file_stat.st_size > 0) {
+    void *mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE,
+        fd, 0);
+    if (mapping != MAP_FAILED) {
+      madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+      source->mapping = mapping;
+      source->text = mapping;
+      source->size = file_stat.st_size;
+      return true;
+    }
+  }
+  return read_source(source, asm_file);
 }
 
-bool is_label(char *asm_line) {
-  return *asm_line == '(';
+void source_from_buffer(asm_source *source, const char *text, size_t size) {
+  memset(source, 0, sizeof(asm_source));
+  source->text = text;
+  source->size = size;
 }
 
-char *get_label(const char *asm_line) {
-  char *right_paren_index = strchr(asm_line + 1, ')');
-  *right_paren_index = '\0';
-  return asm_line;
+void source_close(asm_source *source) {
+  if (source->mapping != NULL) {
+    munmap(source->mapping, source->size);
+  }
+  free(source->buffer);
+  memset(source, 0, sizeof(asm_source));
 }
 
-bool is_a_command(char *asm_line) {
-  return *asm_line == '@';
+// Fallback for inputs that cannot be mapped: read everything in large chunks
+static bool read_source(asm_source *source, FILE *asm_file) {
+  size_t capacity = 0;
+  size_t bytes_read;
+  do {
+    if (source->size + READ_CHUNK > capacity) {
+      capacity = capacity ? capacity * 2 : READ_CHUNK;
+      char *buffer = realloc(source->buffer, capacity);
+      if (buffer == NULL) {
+        source_close(source);
+        return false;
+      }
+      source->buffer = buffer;
+    }
+    bytes_read = fread(source->buffer + source->size, 1, READ_CHUNK, asm_file);
+    source->size += bytes_read;
+  } while (bytes_read == READ_CHUNK);
+  source->text = source->buffer;
+  return true;
 }
 
-void remove_spaces(char *asm_line) {
-  char *no_spaces = asm_line;
-  char c;
-  while ((c = *asm_line) != '\0') {
-    if (!isspace(c)) {
-      *no_spaces++ = c;
+// Sets line to the next line holding an instruction or label, with comments
+// and surrounding whitespace left out. Returns false at the end of the source.
+bool get_line(asm_source *source, line_view *line) {
+  const char *text_end = source->text + source->size;
+  const char *p = source->text + source->pos;
+  while (p < text_end) {
+    const char *line_start = p;
+    const char *newline = memchr(p, '\n', text_end - p);
+    const char *line_end = newline ? newline : text_end;
+    p = newline ? newline + 1 : text_end;
+    const char *comment = line_start;
+    while (comment + 1 < line_end && !(comment[0] == '/' && comment[1] == '/')) {
+      comment++;
+    }
+    if (comment + 1 < line_end) {
+      line_end = comment;
+    }
+    *line = trim(line_start, line_end);
+    if (line->start < line->end) {
+      source->pos = p - source->text;
+      return true;
     }
-    asm_line++;
   }
-  *no_spaces = '\0';
+  source->pos = source->size;
+  return false;
 }
 
-void remove_comments(char *asm_line) {
-  char *comment_start = strstr(asm_line, "//");
-  if (comment_start) {
-    *comment_start = '\0';
-  }
+bool is_label(line_view line) {
+  return *line.start == '(';
 }
 
+line_view get_label(line_view line) {
+  const char *right_paren = memchr(line.start, ')', line.end - line.start);
+  return trim(line.start + 1, right_paren ? right_paren : line.end);
+}
+
+bool is_a_command(line_view line) {
+  return *line.start == '@';
+}
+
+line_view get_a_symbol(line_view line) {
+  return trim(line.start + 1, line.end);
+}
+
+static line_view trim(const char *start, const char *end) {
+  while (start < end && isspace((unsigned char) *start)) {
+    start++;
+  }
+  while (end > start && isspace((unsigned char) end[-1])) {
+    end--;
+  }
+  return (line_view) { start, end };
+}
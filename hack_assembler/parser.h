@@ -1,7 +1,36 @@
+#ifndef PARSER_H
+#define PARSER_H
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// A view of part of the source text. It is not null-terminated; end points
+// one past the last character.
+typedef struct {
+  const char *start;
+  const char *end;
+} line_view;
+
+// The whole text of an .asm file. Regular files are mapped into memory,
+// anything else (pipes, terminals) is read into a heap buffer. Text that is
+// already in memory is used in place. source_open returns false if memory
+// runs out while reading.
+typedef struct {
+  const char *text;
+  size_t size;
+  size_t pos;
+  void *mapping;
+  char *buffer;
+} asm_source;
 
-char *get_line(char *asm_line, int max_line, FILE *asm_file);
-bool is_label(char *asm_line);
-char *get_label(char *asm_line);
-bool is_a_command(char *command);
+bool source_open(asm_source *source, FILE *asm_file);
+void source_from_buffer(asm_source *source, const char *text, size_t size);
+void source_close(asm_source *source);
+bool get_line(asm_source *source, line_view *line);
+bool is_label(line_view line);
+line_view get_label(line_view line);
+bool is_a_command(line_view line);
+line_view get_a_symbol(line_view line);
 
+#endif
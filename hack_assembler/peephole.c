@@ -0,0 +1,251 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "peephole.h"
+#include "symbol_table.h"
+
+#define C_INSTRUCTION   0x8000
+#define COMP_M          0x1000  // a bit: the ALU reads M instead of A
+#define COMP_ZERO_Y     0x0200  // zy bit: the ALU ignores A or M
+#define DEST_A          0x0020
+#define DEST_M          0x0008
+#define JUMP_BITS       0x0007
+#define MAX_JUMP_CHAIN  16
+#define MAX_PATTERN_LEN 7
+
+// encodings of the instructions vm_translator emits around the stack pointer
+#define AT_SP           0x0000  // @SP
+#define AM_M_PLUS_1     0xFDE8  // AM=M+1
+#define AM_M_MINUS_1    0xFCA8  // AM=M-1
+#define A_A_MINUS_1     0xECA0  // A=A-1
+#define A_M             0xFC20  // A=M
+#define A_M_MINUS_1     0xFCA0  // A=M-1
+#define D_M             0xFC10  // D=M
+#define M_D             0xE308  // M=D
+#define JMP             0xEA87  // 0;JMP
+
+typedef struct {
+  int len;
+  uint16_t words[MAX_PATTERN_LEN];
+  int replacement_len;
+  uint16_t replacement[MAX_PATTERN_LEN];
+} stack_pattern;
+
+// Each replacement leaves SP, D, A and memory exactly as the pattern does.
+// Longer patterns come first since the short ones are prefixes of their
+// halves.
+static const stack_pattern stack_patterns[] = {
+  // pop D, push D: only D and A change
+  { 7, { AT_SP, AM_M_MINUS_1, D_M, AT_SP, AM_M_PLUS_1, A_A_MINUS_1, M_D },
+    3, { AT_SP, A_M_MINUS_1, D_M } },
+  // push D, pop D: D is stored just above the stack and A points at it
+  { 7, { AT_SP, AM_M_PLUS_1, A_A_MINUS_1, M_D, AT_SP, AM_M_MINUS_1, D_M },
+    3, { AT_SP, A_M, M_D } },
+  { 4, { AT_SP, AM_M_MINUS_1, AT_SP, AM_M_PLUS_1 },
+    2, { AT_SP, A_M } },
+  { 4, { AT_SP, AM_M_PLUS_1, AT_SP, AM_M_MINUS_1 },
+    2, { AT_SP, A_M } }
+};
+
+typedef struct {
+  program *prog;
+  bool *removed;
+  bool *is_target;
+  unsigned *new_index;
+} optimizer;
+
+static void thread_jumps(optimizer *opt);
+static bool collapse_stack_pairs(optimizer *opt);
+static bool remove_redundant_loads(optimizer *opt);
+static void compact(optimizer *opt);
+static void find_targets(optimizer *opt);
+static void mark_target(const char *symbol, unsigned *value, symbol_kind kind,
+    void *context);
+static void relocate_label(const char *symbol, unsigned *value,
+    symbol_kind kind, void *context);
+
+static inline bool is_a_instruction(uint16_t word) {
+  return !(word & C_INSTRUCTION);
+}
+
+// A jump such as 0;JMP or D;JGT that uses A only as the place to jump to.
+// Comps that read A or M, and stores to M, use it as a value or address too.
+static inline bool only_jumps_to_a(uint16_t word) {
+  return !is_a_instruction(word) && (word & JUMP_BITS)
+      && !(word & COMP_M) && (word & COMP_ZERO_Y) && !(word & DEST_M);
+}
+
+// Removes instructions from the assembled program without changing what it
+// computes, then moves every label and @label to the new addresses.
+// Sets num_removed to the number of instructions removed. Returns false,
+// with the program unchanged, if memory runs out.
+bool peephole_optimize(program *prog, unsigned *num_removed) {
+  unsigned original_len = prog->num_words;
+  optimizer opt = {
+    prog,
+    calloc(original_len + 1, sizeof(bool)),
+    calloc(original_len + 1, sizeof(bool)),
+    calloc(original_len + 1, sizeof(unsigned))
+  };
+  if (opt.removed == NULL || opt.is_target == NULL || opt.new_index == NULL) {
+    free(opt.removed);
+    free(opt.is_target);
+    free(opt.new_index);
+    return program_fail(prog, "malloc error");
+  }
+
+  find_targets(&opt);
+  thread_jumps(&opt);
+  bool changed;
+  do {
+    changed = collapse_stack_pairs(&opt);
+    changed |= remove_redundant_loads(&opt);
+    if (changed) {
+      compact(&opt);
+    }
+  } while (changed);
+
+  free(opt.removed);
+  free(opt.is_target);
+  free(opt.new_index);
+  *num_removed = original_len - prog->num_words;
+  return true;
+}
+
+// @L1 followed by a jump, where L1 holds @L2 and 0;JMP, is pointed at L2
+static void thread_jumps(optimizer *opt) {
+  program *prog = opt->prog;
+  for (unsigned i = 0; i + 1 < prog->num_words; i++) {
+    if (!prog->label_refs[i] || !only_jumps_to_a(prog->words[i + 1])) {
+      continue;
+    }
+    unsigned target = prog->words[i];
+    for (int hops = 0; hops < MAX_JUMP_CHAIN; hops++) {
+      if (target + 1 >= prog->num_words || !prog->label_refs[target]
+          || prog->words[target + 1] != JMP || prog->words[target] == target) {
+        break;
+      }
+      target = prog->words[target];
+    }
+    prog->words[i] = target;
+  }
+}
+
+static bool collapse_stack_pairs(optimizer *opt) {
+  program *prog = opt->prog;
+  int num_patterns = sizeof(stack_patterns) / sizeof(stack_patterns[0]);
+  bool changed = false;
+  for (unsigned i = 0; i < prog->num_words; i++) {
+    for (int p = 0; p < num_patterns; p++) {
+      const stack_pattern *pattern = &stack_patterns[p];
+      if (i + pattern->len > prog->num_words) {
+        continue;
+      }
+      bool match = true;
+      for (int j = 0; j < pattern->len && match; j++) {
+        // control may only enter the pattern at its first instruction
+        match = prog->words[i + j] == pattern->words[j]
+            && !prog->label_refs[i + j] && !opt->removed[i + j]
+            && (j == 0 || !opt->is_target[i + j]);
+      }
+      if (!match) {
+        continue;
+      }
+      memcpy(prog->words + i, pattern->replacement,
+          pattern->replacement_len * sizeof(uint16_t));
+      for (int j = pattern->replacement_len; j < pattern->len; j++) {
+        opt->removed[i + j] = true;
+      }
+      i += pattern->len - 1;
+      changed = true;
+      break;
+    }
+  }
+  return changed;
+}
+
+// Tracks the value of A through straight-line code. An @value that A
+// already holds, or whose value is overwritten by the next @value before it
+// is used, is removed.
+static bool remove_redundant_loads(optimizer *opt) {
+  program *prog = opt->prog;
+  bool changed = false;
+  bool known = false;
+  uint16_t known_word = 0;
+  bool known_label_ref = false;
+  for (unsigned i = 0; i < prog->num_words; i++) {
+    if (opt->removed[i]) {
+      continue;
+    }
+    if (opt->is_target[i]) {
+      known = false;
+    }
+    uint16_t word = prog->words[i];
+    if (!is_a_instruction(word)) {
+      if (word & DEST_A) {
+        known = false;
+      }
+      continue;
+    }
+    unsigned next = i + 1;
+    while (next < prog->num_words && opt->removed[next]) {
+      next++;
+    }
+    if ((known && word == known_word
+        && prog->label_refs[i] == known_label_ref)
+        || (next < prog->num_words && is_a_instruction(prog->words[next])
+        && !opt->is_target[next])) {
+      opt->removed[i] = true;
+      changed = true;
+      continue;
+    }
+    known = true;
+    known_word = word;
+    known_label_ref = prog->label_refs[i];
+  }
+  return changed;
+}
+
+static void compact(optimizer *opt) {
+  program *prog = opt->prog;
+  unsigned kept = 0;
+  for (unsigned i = 0; i < prog->num_words; i++) {
+    opt->new_index[i] = kept;
+    if (!opt->removed[i]) {
+      prog->words[kept] = prog->words[i];
+      prog->label_refs[kept] = prog->label_refs[i];
+      kept++;
+    }
+  }
+  opt->new_index[prog->num_words] = kept;
+  for (unsigned i = 0; i < kept; i++) {
+    if (prog->label_refs[i]) {
+      prog->words[i] = opt->new_index[prog->words[i]];
+    }
+  }
+  symbol_table_for_each(prog->symbols, relocate_label, opt);
+  prog->num_words = kept;
+  memset(opt->removed, 0, (kept + 1) * sizeof(bool));
+  find_targets(opt);
+}
+
+static void find_targets(optimizer *opt) {
+  memset(opt->is_target, 0, (opt->prog->num_words + 1) * sizeof(bool));
+  symbol_table_for_each(opt->prog->symbols, mark_target, opt);
+}
+
+static void mark_target(__attribute__((unused)) const char *symbol,
+    unsigned *value, symbol_kind kind, void *context) {
+  optimizer *opt = context;
+  if (kind == SYMBOL_LABEL) {
+    opt->is_target[*value] = true;
+  }
+}
+
+static void relocate_label(__attribute__((unused)) const char *symbol,
+    unsigned *value, symbol_kind kind, void *context) {
+  optimizer *opt = context;
+  if (kind == SYMBOL_LABEL) {
+    *value = opt->new_index[*value];
+  }
+}
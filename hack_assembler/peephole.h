@@ -0,0 +1,8 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "program.h"
+
+bool peephole_optimize(program *prog, unsigned *num_removed);
+
+#endif
@@ -0,0 +1,297 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "machine_code.h"
+#include "parser.h"
+#include "program.h"
+#include "symbol_table.h"
+
+#define INITIAL_CAPACITY 1024
+#define STACK_START 16
+
+static uint16_t fletcher16(const uint16_t *words, unsigned num_words);
+static void put_le(uint8_t *bytes, unsigned value, int num_bytes);
+static void *grow(void *array, unsigned *capacity, size_t element_size);
+static void collect_map_entry(const char *symbol, unsigned *value,
+    symbol_kind kind, void *context);
+static int compare_map_entries(const void *a, const void *b);
+static bool emit_word(program *prog, uint16_t word, bool is_label_ref);
+static bool emit_a_instruction(program *prog, line_view asm_line);
+static bool add_fixup(program *prog, line_view symbol);
+static bool resolve_fixups(program *prog);
+
+bool program_init(program *prog) {
+  memset(prog, 0, sizeof(program));
+  prog->next_var_addr = STACK_START;
+  prog->symbols = symbol_table_new();
+  if (prog->symbols == NULL) {
+    return program_fail(prog, "malloc error");
+  }
+  return true;
+}
+
+// Encodes every instruction in a single pass over source. A-instructions
+// whose symbol is not yet known may refer to a label further down the file,
+// so they are emitted as placeholders and patched once the file is read.
+bool program_assemble(program *prog, asm_source *source) {
+  line_view asm_line;
+  uint16_t word;
+
+  while (get_line(source, &asm_line)) {
+    if (is_label(asm_line)) {
+      line_view label = get_label(asm_line);
+      if (!symbol_table_add(prog->symbols, label.start,
+          label.end - label.start, prog->num_words, SYMBOL_LABEL)) {
+        return program_fail(prog, "malloc error");
+      }
+    } else if (is_a_command(asm_line)) {
+      if (!emit_a_instruction(prog, asm_line)) {
+        return false;
+      }
+    } else if (!get_c_instruction(asm_line, &word)) {
+      return program_fail(prog, "invalid instruction: %.*s",
+          (int) (asm_line.end - asm_line.start), asm_line.start);
+    } else if (!emit_word(prog, word, false)) {
+      return false;
+    }
+  }
+  return resolve_fixups(prog);
+}
+
+void program_write(const program *prog, FILE *bin_file) {
+  char instruction[COMMAND_LEN];
+
+  for (unsigned i = 0; i < prog->num_words; i++) {
+    word_to_instruction(prog->words[i], instruction);
+    fprintf(bin_file, "%s\n", instruction);
+  }
+}
+
+void program_write_binary(const program *prog, FILE *rom_file) {
+  uint8_t header[ROM_HEADER_SIZE] = {0};
+  memcpy(header, ROM_MAGIC, ROM_MAGIC_LEN);
+  put_le(header + 4, prog->num_words, 4);
+  put_le(header + 8, fletcher16(prog->words, prog->num_words), 2);
+  fwrite(header, 1, ROM_HEADER_SIZE, rom_file);
+
+  uint8_t buffer[2 * INITIAL_CAPACITY];
+  unsigned buffer_len = 0;
+  for (unsigned i = 0; i < prog->num_words; i++) {
+    put_le(buffer + buffer_len, prog->words[i], 2);
+    buffer_len += 2;
+    if (buffer_len == sizeof(buffer)) {
+      fwrite(buffer, 1, buffer_len, rom_file);
+      buffer_len = 0;
+    }
+  }
+  fwrite(buffer, 1, buffer_len, rom_file);
+}
+
+typedef struct {
+  const char *symbol;
+  unsigned value;
+  symbol_kind kind;
+} map_entry;
+
+typedef struct {
+  map_entry *entries;
+  unsigned num_entries;
+  unsigned capacity;
+  bool out_of_memory;
+} symbol_map;
+
+// Writes one tab-separated line per label and variable, labels by ROM
+// address and then variables by RAM address:
+//   label     <address>  <name>
+//   variable  <address>  <name>
+bool program_write_map(program *prog, FILE *map_file) {
+  symbol_map map = {0};
+  symbol_table_for_each(prog->symbols, collect_map_entry, &map);
+  if (map.out_of_memory) {
+    free(map.entries);
+    return program_fail(prog, "malloc error");
+  }
+  qsort(map.entries, map.num_entries, sizeof(map_entry), compare_map_entries);
+  for (unsigned i = 0; i < map.num_entries; i++) {
+    fprintf(map_file, "%s\t%u\t%s\n",
+        map.entries[i].kind == SYMBOL_LABEL ? "label" : "variable",
+        map.entries[i].value, map.entries[i].symbol);
+  }
+  free(map.entries);
+  return true;
+}
+
+// Sets prog->error from a printf-style format and returns false, so error
+// paths can end with return program_fail(...)
+bool program_fail(program *prog, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(prog->error, PROGRAM_ERROR_LEN, format, args);
+  va_end(args);
+  return false;
+}
+
+void program_free(program *prog) {
+  if (prog->symbols != NULL) {
+    symbol_table_free(prog->symbols);
+  }
+  free(prog->words);
+  free(prog->label_refs);
+  free(prog->fixups);
+  free(prog->fixup_names);
+  memset(prog, 0, sizeof(program));
+}
+
+// Fletcher-16 over the little-endian byte image of the words
+static uint16_t fletcher16(const uint16_t *words, unsigned num_words) {
+  unsigned sum1 = 0, sum2 = 0;
+  for (unsigned i = 0; i < num_words; i++) {
+    sum1 = (sum1 + (words[i] & 0xFF)) % 255;
+    sum2 = (sum2 + sum1) % 255;
+    sum1 = (sum1 + (words[i] >> 8)) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return (sum2 << 8) | sum1;
+}
+
+static void put_le(uint8_t *bytes, unsigned value, int num_bytes) {
+  for (int i = 0; i < num_bytes; i++) {
+    bytes[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+// Returns the array with twice the capacity, or NULL with the array and
+// capacity left as they were if memory runs out
+static void *grow(void *array, unsigned *capacity, size_t element_size) {
+  unsigned new_capacity = *capacity ? *capacity * 2 : INITIAL_CAPACITY;
+  array = realloc(array, new_capacity * element_size);
+  if (array != NULL) {
+    *capacity = new_capacity;
+  }
+  return array;
+}
+
+static void collect_map_entry(const char *symbol, unsigned *value,
+    symbol_kind kind, void *context) {
+  symbol_map *map = context;
+  if (kind != SYMBOL_LABEL && kind != SYMBOL_VARIABLE) {
+    return;
+  }
+  if (map->out_of_memory) {
+    return;
+  }
+  if (map->num_entries == map->capacity) {
+    map_entry *entries = grow(map->entries, &map->capacity,
+        sizeof(map_entry));
+    if (entries == NULL) {
+      map->out_of_memory = true;
+      return;
+    }
+    map->entries = entries;
+  }
+  map->entries[map->num_entries++] = (map_entry) {symbol, *value, kind};
+}
+
+static int compare_map_entries(const void *a, const void *b) {
+  const map_entry *entry_a = a;
+  const map_entry *entry_b = b;
+  if (entry_a->kind != entry_b->kind) {
+    return entry_a->kind == SYMBOL_LABEL ? -1 : 1;
+  }
+  if (entry_a->value != entry_b->value) {
+    return entry_a->value < entry_b->value ? -1 : 1;
+  }
+  return strcmp(entry_a->symbol, entry_b->symbol);
+}
+
+static bool emit_word(program *prog, uint16_t word, bool is_label_ref) {
+  if (prog->num_words == prog->words_capacity) {
+    // label_refs is grown first, so words_capacity only changes once both
+    // arrays are large enough
+    unsigned capacity = prog->words_capacity;
+    bool *label_refs = grow(prog->label_refs, &capacity, sizeof(bool));
+    if (label_refs == NULL) {
+      return program_fail(prog, "malloc error");
+    }
+    prog->label_refs = label_refs;
+    uint16_t *words = grow(prog->words, &prog->words_capacity,
+        sizeof(uint16_t));
+    if (words == NULL) {
+      return program_fail(prog, "malloc error");
+    }
+    prog->words = words;
+  }
+  prog->label_refs[prog->num_words] = is_label_ref;
+  prog->words[prog->num_words++] = word;
+  return true;
+}
+
+static bool emit_a_instruction(program *prog, line_view asm_line) {
+  line_view symbol = get_a_symbol(asm_line);
+  unsigned value;
+  symbol_kind kind;
+  if (is_number(symbol)) {
+    return emit_word(prog, get_number(symbol), false);
+  } else if ((kind = symbol_table_find(prog->symbols, symbol.start,
+      symbol.end - symbol.start, &value)) != SYMBOL_NONE) {
+    return emit_word(prog, value, kind == SYMBOL_LABEL);
+  } else {
+    return add_fixup(prog, symbol) && emit_word(prog, 0, false);
+  }
+}
+
+static bool add_fixup(program *prog, line_view symbol) {
+  unsigned symbol_len = symbol.end - symbol.start;
+  unsigned symbol_size = symbol_len + 1;
+  while (prog->fixup_names_len + symbol_size > prog->fixup_names_capacity) {
+    char *fixup_names = grow(prog->fixup_names, &prog->fixup_names_capacity,
+        sizeof(char));
+    if (fixup_names == NULL) {
+      return program_fail(prog, "malloc error");
+    }
+    prog->fixup_names = fixup_names;
+  }
+  if (prog->num_fixups == prog->fixups_capacity) {
+    fixup *fixups = grow(prog->fixups, &prog->fixups_capacity,
+        sizeof(fixup));
+    if (fixups == NULL) {
+      return program_fail(prog, "malloc error");
+    }
+    prog->fixups = fixups;
+  }
+  fixup *new_fixup = &prog->fixups[prog->num_fixups++];
+  new_fixup->word_index = prog->num_words;
+  new_fixup->name_offset = prog->fixup_names_len;
+  memcpy(prog->fixup_names + prog->fixup_names_len, symbol.start, symbol_len);
+  prog->fixup_names[prog->fixup_names_len + symbol_len] = '\0';
+  prog->fixup_names_len += symbol_size;
+  return true;
+}
+
+// Fixups are kept in the order their instructions appeared, so any symbol
+// that turns out not to be a label is given the same variable address the
+// two-pass assembler would have given it.
+static bool resolve_fixups(program *prog) {
+  for (unsigned i = 0; i < prog->num_fixups; i++) {
+    char *symbol = prog->fixup_names + prog->fixups[i].name_offset;
+    unsigned symbol_len = strlen(symbol);
+    unsigned word_index = prog->fixups[i].word_index;
+    unsigned value;
+    symbol_kind kind = symbol_table_find(prog->symbols, symbol, symbol_len,
+        &value);
+    if (kind == SYMBOL_NONE) {
+      value = prog->next_var_addr++;
+      if (!symbol_table_add(prog->symbols, symbol, symbol_len, value,
+          SYMBOL_VARIABLE)) {
+        return program_fail(prog, "malloc error");
+      }
+    }
+    prog->words[word_index] = value;
+    prog->label_refs[word_index] = kind == SYMBOL_LABEL;
+  }
+  prog->num_fixups = 0;
+  prog->fixup_names_len = 0;
+  return true;
+}
@@ -0,0 +1,55 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "parser.h"
+#include "symbol_table.h"
+
+// Packed ROM image written by program_write_binary. All fields are
+// little-endian:
+//   bytes 0-3   magic "HACK"
+//   bytes 4-7   number of 16-bit words that follow the header
+//   bytes 8-9   Fletcher-16 checksum of the word bytes
+//   bytes 10-11 reserved, always 0
+#define ROM_MAGIC       "HACK"
+#define ROM_MAGIC_LEN   4
+#define ROM_HEADER_SIZE 12
+#define PROGRAM_ERROR_LEN 128
+
+typedef struct {
+  unsigned word_index;
+  unsigned name_offset;
+} fixup;
+
+// Everything needed to assemble one file. Programs share no state, so
+// separate files can be assembled on separate threads. Functions that
+// return false leave the reason in error and never exit, so the program can
+// still be freed.
+typedef struct {
+  symbol_table *symbols;
+  unsigned next_var_addr;
+  uint16_t *words;
+  bool *label_refs;  // true where words[i] is @label, i.e. a ROM address
+  unsigned num_words;
+  unsigned words_capacity;
+  fixup *fixups;
+  unsigned num_fixups;
+  unsigned fixups_capacity;
+  char *fixup_names;
+  unsigned fixup_names_len;
+  unsigned fixup_names_capacity;
+  char error[PROGRAM_ERROR_LEN];
+} program;
+
+bool program_init(program *prog);
+bool program_assemble(program *prog, asm_source *source);
+void program_write(const program *prog, FILE *bin_file);
+void program_write_binary(const program *prog, FILE *rom_file);
+bool program_write_map(program *prog, FILE *map_file);
+bool program_fail(program *prog, const char *format, ...);
+void program_free(program *prog);
+
+#endif
@@ -3,107 +3,255 @@
 #include <string.h>
 #include "symbol_table.h"
 
-#define TABLE_SIZE 100
+#define INITIAL_TABLE_SIZE 256  // must be a power of two
+#define MAX_LOAD_PERCENT    70
+#define POOL_BLOCK_SIZE  65536
+#define MAX_PROBE_BUCKET    16
+#define FNV_OFFSET  2166136261u
+#define FNV_PRIME     16777619u
 
-typedef struct node {
-  char *symbol;
+typedef struct {
+  char *symbol;  // NULL if the slot is empty
+  unsigned len;
+  unsigned hash;
   unsigned value;
-  struct node *next;
+  symbol_kind kind;
 } Entry;
 
-static Entry *symbol_table[TABLE_SIZE];
+// Symbols are copied into large blocks instead of being malloced one by one
+typedef struct pool_block {
+  struct pool_block *next;
+  size_t used;
+  char data[POOL_BLOCK_SIZE];
+} PoolBlock;
+
+static const struct {
+  char *symbol;
+  unsigned value;
+} predefined[] = {
+  { "R0",     0 },
+  { "R1",     1 },
+  { "R2",     2 },
+  { "R3",     3 },
+  { "R4",     4 },
+  { "R5",     5 },
+  { "R6",     6 },
+  { "R7",     7 },
+  { "R8",     8 },
+  { "R9",     9 },
+  { "R10",    10 },
+  { "R11",    11 },
+  { "R12",    12 },
+  { "R13",    13 },
+  { "R14",    14 },
+  { "R15",    15 },
+  { "SCREEN", 16384 },
+  { "KBD",    24576 },
+  { "SP",     0 },
+  { "LCL",    1 },
+  { "ARG",    2 },
+  { "THIS",   3 },
+  { "THAT",   4 }
+};
+
+struct symbol_table {
+  Entry *entries;
+  unsigned size;
+  unsigned num_entries;
+  PoolBlock *string_pool;
+  // probe length diagnostics, printed by symbol_table_print_stats
+  unsigned long num_lookups;
+  unsigned long total_probes;
+  unsigned long probe_counts[MAX_PROBE_BUCKET + 1];
+};
 
-static unsigned hash(char *symbol) {
-  unsigned hash_val;
-  for (hash_val = 0; *symbol != '\0'; symbol++) {
-    hash_val = *symbol + 31 * hash_val;
+static unsigned hash(const char *symbol, unsigned len) {
+  unsigned hash_val = FNV_OFFSET;
+  for (unsigned i = 0; i < len; i++) {
+    hash_val = (hash_val ^ (unsigned char) symbol[i]) * FNV_PRIME;
   }
-  return hash_val % TABLE_SIZE;
+  // fold the high bits down since the table only indexes with the low ones
+  return hash_val ^ hash_val >> 16;
 }
 
-static Entry *lookup(char *symbol) {
-  unsigned hash_val = hash(symbol);
-  Entry *entry = symbol_table[hash_val];
-  while (entry != NULL) {
-    if (strcmp(entry->symbol, symbol) == 0) {
-      return entry;
+static char *pool_strdup(symbol_table *table, const char *symbol,
+    unsigned len) {
+  size_t size = len + 1;
+  PoolBlock *pool = table->string_pool;
+  if (pool == NULL || pool->used + size > POOL_BLOCK_SIZE) {
+    PoolBlock *block = malloc(size > POOL_BLOCK_SIZE
+        ? sizeof(PoolBlock) + size - POOL_BLOCK_SIZE : sizeof(PoolBlock));
+    if (block == NULL) {
+      return NULL;
     }
-    entry = entry->next;
+    block->next = pool;
+    block->used = 0;
+    table->string_pool = pool = block;
   }
-  return NULL;
+  char *copy = pool->data + pool->used;
+  memcpy(copy, symbol, len);
+  copy[len] = '\0';
+  pool->used += size;
+  return copy;
 }
 
-void symbol_table_init() {
-  symbol_table_add("R0", 0);
-  symbol_table_add("R1", 1);
-  symbol_table_add("R2", 2);
-  symbol_table_add("R3", 3);
-  symbol_table_add("R4", 4);
-  symbol_table_add("R5", 5);
-  symbol_table_add("R6", 6);
-  symbol_table_add("R7", 7);
-  symbol_table_add("R8", 8);
-  symbol_table_add("R9", 9);
-  symbol_table_add("R10", 10);
-  symbol_table_add("R11", 11);
-  symbol_table_add("R12", 12);
-  symbol_table_add("R13", 13);
-  symbol_table_add("R14", 14);
-  symbol_table_add("R15", 15);
-  symbol_table_add("SCREEN", 16384);
-  symbol_table_add("KBD", 24576);
-  symbol_table_add("SP", 0);
-  symbol_table_add("LCL", 1);
-  symbol_table_add("ARG", 2);
-  symbol_table_add("THIS", 3);
-  symbol_table_add("THAT", 4);
+// Linear probing: returns the slot holding symbol, or the empty slot where it
+// would be inserted
+static Entry *probe(const symbol_table *table, const char *symbol,
+    unsigned len, unsigned hash_val, unsigned *probes) {
+  unsigned mask = table->size - 1;
+  Entry *entry;
+  *probes = 1;
+  for (unsigned i = hash_val & mask; ; i = (i + 1) & mask, (*probes)++) {
+    entry = &table->entries[i];
+    if (entry->symbol == NULL || (entry->hash == hash_val
+        && entry->len == len && memcmp(entry->symbol, symbol, len) == 0)) {
+      return entry;
+    }
+  }
 }
 
-bool symbol_table_contains(char *symbol) {
-  return lookup(symbol) != NULL;
+static Entry *lookup(symbol_table *table, const char *symbol, unsigned len,
+    unsigned hash_val) {
+  unsigned probes;
+  Entry *entry = probe(table, symbol, len, hash_val, &probes);
+  table->num_lookups++;
+  table->total_probes += probes;
+  table->probe_counts[probes < MAX_PROBE_BUCKET ? probes : MAX_PROBE_BUCKET]++;
+  return entry;
 }
 
-void symbol_table_add(char *symbol, unsigned value) {
-  Entry *new_entry = (Entry *) malloc(sizeof(Entry));
-  if (new_entry == NULL) {
-    printf("malloc error\n");
-    exit(EXIT_FAILURE);
-  }
-  new_entry->symbol = (char *) malloc((strlen(symbol) + 1) * sizeof(char));
-  if (new_entry->symbol == NULL) {
-    printf("malloc error\n");
-    exit(EXIT_FAILURE);
-  }
-  strcpy(new_entry->symbol, symbol);
-  new_entry->value = value;
-  new_entry->next = NULL;
-  unsigned hash_val = hash(symbol);
-  Entry *entry = symbol_table[hash_val];
-  if (entry == NULL) {
-    symbol_table[hash_val] = new_entry;
-  } else {
-    while (entry->next != NULL) {
-      entry = entry->next;
+// Leaves the table as it was and returns false if memory runs out
+static bool resize(symbol_table *table, unsigned new_size) {
+  Entry *old_entries = table->entries;
+  unsigned old_size = table->size;
+  Entry *new_entries = calloc(new_size, sizeof(Entry));
+  if (new_entries == NULL) {
+    return false;
+  }
+  table->entries = new_entries;
+  table->size = new_size;
+  unsigned probes;
+  for (unsigned i = 0; i < old_size; i++) {
+    if (old_entries[i].symbol != NULL) {
+      *probe(table, old_entries[i].symbol, old_entries[i].len,
+          old_entries[i].hash, &probes) = old_entries[i];
     }
-    entry->next = new_entry;
   }
+  free(old_entries);
+  return true;
+}
+
+// Returns a new table holding the predefined Hack symbols
+symbol_table *symbol_table_new(void) {
+  symbol_table *table = calloc(1, sizeof(symbol_table));
+  if (table == NULL) {
+    return NULL;
+  }
+  bool added = resize(table, INITIAL_TABLE_SIZE);
+  for (unsigned i = 0; added
+      && i < sizeof(predefined) / sizeof(predefined[0]); i++) {
+    added = symbol_table_add(table, predefined[i].symbol,
+        strlen(predefined[i].symbol), predefined[i].value, SYMBOL_PREDEFINED);
+  }
+  if (!added) {
+    symbol_table_free(table);
+    return NULL;
+  }
+  return table;
+}
+
+void symbol_table_free(symbol_table *table) {
+  PoolBlock *block = table->string_pool;
+  while (block != NULL) {
+    PoolBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  free(table->entries);
+  free(table);
 }
 
-unsigned symbol_table_get(char *symbol) {
-  Entry *entry = lookup(symbol);
-  if (entry == NULL) {
+bool symbol_table_contains(symbol_table *table, const char *symbol,
+    unsigned len) {
+  return lookup(table, symbol, len, hash(symbol, len))->symbol != NULL;
+}
+
+// Returns the kind of symbol, or SYMBOL_NONE if it is not in the table
+symbol_kind symbol_table_find(symbol_table *table, const char *symbol,
+    unsigned len, unsigned *value) {
+  Entry *entry = lookup(table, symbol, len, hash(symbol, len));
+  if (entry->symbol == NULL) {
+    return SYMBOL_NONE;
+  }
+  *value = entry->value;
+  return entry->kind;
+}
+
+// Adding a symbol that is already defined keeps its first value
+bool symbol_table_add(symbol_table *table, const char *symbol, unsigned len,
+    unsigned value, symbol_kind kind) {
+  if ((table->num_entries + 1) * 100 > table->size * MAX_LOAD_PERCENT
+      && !resize(table, table->size * 2)) {
+    return false;
+  }
+  unsigned hash_val = hash(symbol, len);
+  Entry *entry = lookup(table, symbol, len, hash_val);
+  if (entry->symbol != NULL) {
+    return true;
+  }
+  entry->symbol = pool_strdup(table, symbol, len);
+  if (entry->symbol == NULL) {
+    return false;
+  }
+  entry->len = len;
+  entry->hash = hash_val;
+  entry->value = value;
+  entry->kind = kind;
+  table->num_entries++;
+  return true;
+}
+
+unsigned symbol_table_get(symbol_table *table, const char *symbol,
+    unsigned len) {
+  Entry *entry = lookup(table, symbol, len, hash(symbol, len));
+  if (entry->symbol == NULL) {
     return -1;
   }
   return entry->value;
 }
 
-void symbol_table_print(void) {
-  for (int hash_val = 0; hash_val < TABLE_SIZE; hash_val++) {
-    printf("%d: ", hash_val);
-    for (Entry *entry = symbol_table[hash_val]; entry != NULL; entry = entry->next) {
-      printf("{%s: %d} -> ", entry->symbol, entry->value);
+// Calls visit on every symbol. The visitor may change the symbol's value.
+void symbol_table_for_each(symbol_table *table, symbol_visitor visit,
+    void *context) {
+  for (unsigned i = 0; i < table->size; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->symbol != NULL) {
+      visit(entry->symbol, &entry->value, entry->kind, context);
+    }
+  }
+}
+
+void symbol_table_print(const symbol_table *table) {
+  for (unsigned i = 0; i < table->size; i++) {
+    if (table->entries[i].symbol != NULL) {
+      printf("%u: {%s: %u}\n", i, table->entries[i].symbol,
+          table->entries[i].value);
     }
-    printf("\n");
   }
+  symbol_table_print_stats(table, stdout);
 }
 
+void symbol_table_print_stats(const symbol_table *table, FILE *stream) {
+  fprintf(stream, "symbol table: %u entries in %u slots, %lu lookups, "
+      "%.2f probes per lookup\n", table->num_entries, table->size,
+      table->num_lookups, table->num_lookups
+      ? (double) table->total_probes / table->num_lookups : 0.0);
+  for (int probes = 1; probes <= MAX_PROBE_BUCKET; probes++) {
+    if (table->probe_counts[probes] != 0) {
+      fprintf(stream, "  %s%2d probes: %lu\n",
+          probes == MAX_PROBE_BUCKET ? ">=" : "  ", probes,
+          table->probe_counts[probes]);
+    }
+  }
+}
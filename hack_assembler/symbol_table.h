@@ -1,8 +1,36 @@
+#ifndef SYMBOL_TABLE_H
+#define SYMBOL_TABLE_H
+
 #include <stdbool.h>
+#include <stdio.h>
+
+typedef struct symbol_table symbol_table;
+
+typedef enum {
+  SYMBOL_NONE,  // not in the table
+  SYMBOL_PREDEFINED,
+  SYMBOL_LABEL,
+  SYMBOL_VARIABLE
+} symbol_kind;
+
+typedef void (*symbol_visitor)(const char *symbol, unsigned *value,
+    symbol_kind kind, void *context);
 
-void symbol_table_init();
-bool symbol_table_contains(char *symbol);
-void symbol_table_add(char *symbol, unsigned value);
-unsigned symbol_table_get(char *symbol);
-void symbol_table_print(void);
+// symbol_table_new returns NULL and symbol_table_add returns false when
+// memory runs out
+symbol_table *symbol_table_new(void);
+void symbol_table_free(symbol_table *table);
+bool symbol_table_contains(symbol_table *table, const char *symbol,
+    unsigned len);
+symbol_kind symbol_table_find(symbol_table *table, const char *symbol,
+    unsigned len, unsigned *value);
+bool symbol_table_add(symbol_table *table, const char *symbol, unsigned len,
+    unsigned value, symbol_kind kind);
+unsigned symbol_table_get(symbol_table *table, const char *symbol,
+    unsigned len);
+void symbol_table_for_each(symbol_table *table, symbol_visitor visit,
+    void *context);
+void symbol_table_print(const symbol_table *table);
+void symbol_table_print_stats(const symbol_table *table, FILE *stream);
 
+#endif
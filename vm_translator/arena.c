@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "error_check.h"
+
+#define MAX_INT_DIGITS 10
+
+static void reserve(arena *buffer, size_t len);
+
+/*******************************************************************************
+** Function: arena_init
+** Description: Allocates an empty arena
+** Parameters:
+**     - capacity: Number of characters to allocate room for up front
+** Pre-Conditions: capacity > 0
+** Post-Conditions: Return value is non-null
+*******************************************************************************/
+arena *arena_init(size_t capacity) {
+    arena *buffer = safe_malloc(sizeof(arena));
+    buffer->data = safe_malloc(capacity * sizeof(char));
+    buffer->len = 0;
+    buffer->capacity = capacity;
+    return buffer;
+}
+
+/*******************************************************************************
+** Function: arena_append
+** Description: Appends len characters of text to the arena. The arena is not
+**     null-terminated; callers that need a string append a '\0' themselves.
+** Parameters:
+**     - buffer: Arena to append to
+**     - text: Characters to append
+**     - len: Number of characters to append
+** Pre-Conditions: buffer and text are non-null
+** Post-Conditions: Pointers into buffer->data are invalid if it grew
+*******************************************************************************/
+void arena_append(arena *buffer, const char *text, size_t len) {
+    reserve(buffer, len);
+    memcpy(buffer->data + buffer->len, text, len);
+    buffer->len += len;
+}
+
+/*******************************************************************************
+** Function: arena_append_string
+** Description: Appends a null-terminated string, without its terminator
+** Parameters:
+**     - buffer: Arena to append to
+**     - string: String to append
+** Pre-Conditions: buffer and string are non-null
+** Post-Conditions: Pointers into buffer->data are invalid if it grew
+*******************************************************************************/
+void arena_append_string(arena *buffer, const char *string) {
+    arena_append(buffer, string, strlen(string));
+}
+
+/*******************************************************************************
+** Function: arena_append_char
+** Description: Appends a single character
+** Parameters:
+**     - buffer: Arena to append to
+**     - c: Character to append
+** Pre-Conditions: buffer is non-null
+** Post-Conditions: Pointers into buffer->data are invalid if it grew
+*******************************************************************************/
+void arena_append_char(arena *buffer, char c) {
+    reserve(buffer, 1);
+    buffer->data[buffer->len++] = c;
+}
+
+/*******************************************************************************
+** Function: arena_append_int
+** Description: Appends the decimal digits of value, zero-padded to at least
+**     min_digits digits. Digits are produced directly rather than through
+**     printf.
+** Parameters:
+**     - buffer: Arena to append to
+**     - value: Integer to append
+**     - min_digits: Minimum number of digits, at most MAX_INT_DIGITS
+** Pre-Conditions: buffer is non-null
+** Post-Conditions: Pointers into buffer->data are invalid if it grew
+*******************************************************************************/
+void arena_append_int(arena *buffer, int value, int min_digits) {
+    char digits[MAX_INT_DIGITS];
+    int num_digits = 0;
+    unsigned magnitude = value < 0 ? 0u - (unsigned) value : (unsigned) value;
+    do {
+        digits[num_digits++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    while (num_digits < min_digits && num_digits < MAX_INT_DIGITS) {
+        digits[num_digits++] = '0';
+    }
+    reserve(buffer, num_digits + 1);
+    if (value < 0) {
+        buffer->data[buffer->len++] = '-';
+    }
+    while (num_digits > 0) {
+        buffer->data[buffer->len++] = digits[--num_digits];
+    }
+}
+
+/*******************************************************************************
+** Function: arena_clear
+** Description: Empties the arena, keeping its memory for reuse
+** Parameters:
+**     - buffer: Arena to empty
+** Pre-Conditions: buffer is non-null
+** Post-Conditions: buffer->len is 0
+*******************************************************************************/
+void arena_clear(arena *buffer) {
+    buffer->len = 0;
+}
+
+/*******************************************************************************
+** Function: arena_dispose
+** Description: Frees the arena and its contents
+** Parameters:
+**     - buffer: Arena to free
+** Pre-Conditions: buffer is non-null
+** Post-Conditions: buffer is freed
+*******************************************************************************/
+void arena_dispose(arena *buffer) {
+    free(buffer->data);
+    free(buffer);
+}
+
+/*******************************************************************************
+** Function: reserve
+** Description: Makes room for len more characters, doubling the capacity as
+**     many times as needed
+** Parameters:
+**     - buffer: Arena to grow
+**     - len: Number of characters that will be appended
+** Pre-Conditions: buffer is non-null
+** Post-Conditions: buffer->capacity >= buffer->len + len
+*******************************************************************************/
+static void reserve(arena *buffer, size_t len) {
+    if (buffer->len + len <= buffer->capacity) {
+        return;
+    }
+    while (buffer->len + len > buffer->capacity) {
+        buffer->capacity *= 2;
+    }
+    buffer->data = realloc(buffer->data, buffer->capacity * sizeof(char));
+    assert_nonnull(buffer->data, "Error allocating memory");
+}
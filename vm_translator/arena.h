@@ -0,0 +1,22 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// growable character buffer that text is appended to and that is emptied as
+// a whole, so its memory is reused instead of freed piece by piece
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} arena;
+
+arena *arena_init(size_t capacity);
+void arena_append(arena *buffer, const char *text, size_t len);
+void arena_append_string(arena *buffer, const char *string);
+void arena_append_char(arena *buffer, char c);
+void arena_append_int(arena *buffer, int value, int min_digits);
+void arena_clear(arena *buffer);
+void arena_dispose(arena *buffer);
+
+#endif
@@ -1,20 +1,42 @@
 #include <math.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "asm_writer.h"
 #include "error_check.h"
+#include "fold.h"
 #include "hash_table.h"
+#include "parser.h"
+#include "program.h"
 
 #define TEMP_START 5
-#define MAX_OPERATOR_LEN 9
-#define MAX_OPERAND_LEN 50
-#define NUM_VM_OPERATORS 17
+#define STACK_START 256
 #define VM_FILE_NAME_MAX_LEN 50
 #define CALL_COUNT_LEN 4
 #define CALL_COUNT_TABLE_SIZE 100
+#define FRAGMENT_ARENA_LEN 4096
+#define FRAGMENT_READ_LEN 65536
+// change whenever the code written for a vm file changes, so that fragments
+// saved by older builds are not reused
+#define FRAGMENT_VERSION 3
+#define FRAGMENT_HEADER_FORMAT "vm_translator fragment %d %d\n"
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define LABEL_ARENA_LEN 64
+#define COMMAND_BUFFER_LEN 256
+// words that reach a segment entry without an A=M+1 chain: the address is
+// computed into A for loads, into R13 for pops, and into D beside the popped
+// value for pops from D
+#define LOAD_ADDRESS_WORDS 4
+#define STORE_ADDRESS_WORDS 8
+#define CACHED_STORE_ADDRESS_WORDS 9
+#define SHARED_CALL_LABEL "$call"
+#define SHARED_RETURN_LABEL "$return"
+#define MAX_SYMBOL_LEN (VM_FILE_NAME_MAX_LEN + 12)
 
 #define PUSH_D \
         "@SP\n" \
@@ -35,114 +57,599 @@
         "AM=M-1\n" \
         "D=M\n"
 
-typedef struct {
-    char operand[MAX_OPERAND_LEN];
-    unsigned value;
-} cmd_args;
+typedef void (*command_writer)(const vm_instruction *args);
 
+// comparison operator, which can be written as a shared routine or fused
+// with a following if-goto
 typedef struct {
-    char *name;
-    void (*write_function)(const cmd_args *args);
-} vm_command;
+    vm_operator operator;
+    const char *name;
+    const char *jump_code;
+    const char *inverse_jump_code;
+    bool used;
+} comparison;
 
+// ROM size counters that written code is added to
+typedef enum {
+    COUNT_ALL,      // code written the same way in every mode
+    COUNT_SHARED,   // shared routines and the short sequences that use them
+    COUNT_INLINE    // code the shared routines replace; counted, not written
+} rom_count_mode;
+
+static void write_asm(const char *format, ...);
+static void count_rom_words(const char *asm_code, size_t asm_code_len);
 static void write_vm_comment(const char *vm_line);
-static vm_command *get_vm_command(const char *operator);
-static void write_vm_comment(const char *vm_line);
-static void write_push(const cmd_args *args);
-static void write_push_segment(const char *segment, int value);
-static void write_pop(const cmd_args *args);
-static void write_pop_segment(const char *segment, int value);
-static void write_add(const cmd_args *args);
-static void write_sub(const cmd_args *args);
-static void write_neg(const cmd_args *args);
-static void write_eq(const cmd_args *args);
-static void write_lt(const cmd_args *args);
-static void write_gt(const cmd_args *args);
-static void write_and(const cmd_args *args);
-static void write_or(const cmd_args *args);
-static void write_not(const cmd_args *args);
-static void write_label(const cmd_args *args);
-static void write_goto(const cmd_args *args);
-static void write_if_goto(const cmd_args *args);
-static void write_call(const cmd_args *args);
-static void write_function(const cmd_args *args);
-static void write_return(const cmd_args *args);
+static void write_instruction(const char *vm_line,
+        const vm_instruction *args);
+static void write_push(const vm_instruction *args);
+static void write_push_segment(vm_segment segment, unsigned value);
+static void write_pop(const vm_instruction *args);
+static void write_pop_segment(vm_segment segment, unsigned value);
+static bool use_entry_chain(vm_segment segment, unsigned offset,
+        unsigned address_words);
+static void write_entry_address(vm_segment segment, unsigned offset);
+static void write_add(const vm_instruction *args);
+static void write_sub(const vm_instruction *args);
+static void write_neg(const vm_instruction *args);
+static void write_eq(const vm_instruction *args);
+static void write_lt(const vm_instruction *args);
+static void write_gt(const vm_instruction *args);
+static void write_and(const vm_instruction *args);
+static void write_or(const vm_instruction *args);
+static void write_not(const vm_instruction *args);
+static void write_label(const vm_instruction *args);
+static void write_goto(const vm_instruction *args);
+static void write_if_goto(const vm_instruction *args);
+static void write_call(const vm_instruction *args);
+static void write_function(const vm_instruction *args);
+static void write_return(const vm_instruction *args);
+static void write_inline_call(const char *function_name, int num_args,
+        const char *return_label);
+static void write_shared_call(const char *function_name, int num_args,
+        const char *return_label);
+static void write_inline_return();
+static void write_static_call(const vm_function *callee, int num_args,
+        const char *return_label);
+static void write_static_function(const vm_function *function);
+static void write_static_return();
+static void write_frame_arguments(const vm_function *callee, int num_args);
+static void write_frame_entry(const vm_function *function);
+static void write_frame_exit(const vm_function *function);
+static void write_inlined_call(const vm_function *callee, int num_args);
+static const vm_function *find_static_frame(const char *function_name);
+static const char *get_segment_pointer(vm_segment segment);
+static void write_shared_routines();
+static unsigned long long hash_bytes(unsigned long long hash,
+        const void *bytes, size_t len);
+static void buffer_command(const char *vm_line, const vm_instruction *args);
+static void flush_command_buffer();
+static void write_commands(vm_command *commands, unsigned num_commands);
+static void write_load_constant(unsigned value);
+static void write_constant_operation(char binary_operator, unsigned value);
+static void write_cached_push(const vm_instruction *args);
+static void write_cached_pop(const vm_instruction *args);
+static void spill_tos();
+static void write_load(const vm_instruction *args);
+static void write_move(const vm_instruction *source, const vm_instruction *target);
+static void flush_pending_commands();
+static void get_fixed_symbol(const vm_instruction *args, char *symbol);
 static void write_binary_operation(const char binary_operator);
 static void write_comparison(const char *jump_code, int count);
-static char *get_return_label(const char *function_name);
-
-static vm_command cmd_list[] = {
-    { "push",     write_push     },
-    { "pop",      write_pop      },
-    { "add",      write_add      },
-    { "sub",      write_sub      },
-    { "neg",      write_neg      },
-    { "eq",       write_eq       },
-    { "lt",       write_lt       },
-    { "gt",       write_gt       },
-    { "and",      write_and      },
-    { "or",       write_or       },
-    { "not",      write_not      },
-    { "label",    write_label    },
-    { "goto",     write_goto     },
-    { "if-goto",  write_if_goto  },
-    { "call",     write_call     },
-    { "function", write_function },
-    { "return",   write_return   }
+static void write_inline_comparison(const char *jump_code, const char *label);
+static void write_cached_comparison(const char *jump_code, const char *label);
+static comparison *get_comparison(const char *jump_code);
+static comparison *find_comparison(vm_operator operator);
+static void write_branch(const comparison *branch_comparison, bool negated,
+        const char *label);
+static const char *get_return_label(const char *function_name);
+static const char *make_label(const char *name, const char *suffix,
+        int count, int min_digits);
+
+static const command_writer command_writers[NUM_VM_OPERATORS] = {
+    [OP_PUSH]     = write_push,
+    [OP_POP]      = write_pop,
+    [OP_ADD]      = write_add,
+    [OP_SUB]      = write_sub,
+    [OP_NEG]      = write_neg,
+    [OP_EQ]       = write_eq,
+    [OP_LT]       = write_lt,
+    [OP_GT]       = write_gt,
+    [OP_AND]      = write_and,
+    [OP_OR]       = write_or,
+    [OP_NOT]      = write_not,
+    [OP_LABEL]    = write_label,
+    [OP_GOTO]     = write_goto,
+    [OP_IF_GOTO]  = write_if_goto,
+    [OP_CALL]     = write_call,
+    [OP_FUNCTION] = write_function,
+    [OP_RETURN]   = write_return
+};
+
+// base pointer of each segment that is addressed through one
+static const char *const segment_pointers[NUM_SEGMENTS] = {
+    [SEG_LOCAL]    = "LCL",
+    [SEG_ARGUMENT] = "ARG",
+    [SEG_THIS]     = "THIS",
+    [SEG_THAT]     = "THAT"
 };
 
+// set up before any fragment is written and only read afterwards
 static FILE *asm_file;
-static char current_vm_file_name[VM_FILE_NAME_MAX_LEN];
-static hash_table *call_counts;
+static writer_options options;
+// with static frames, the program whose functions' frames were assigned and
+// the address the stack starts at
+static const vm_program *frame_program = NULL;
+static unsigned stack_start = STACK_START;
+// totals over the fragments linked so far
+static asm_fragment linked;
+
+// the state below belongs to the fragment being written; each thread writes
+// its own fragment, so it is thread-local
+static _Thread_local comparison comparisons[] = {
+    { OP_EQ, "eq", "JEQ", "JNE", false },
+    { OP_LT, "lt", "JLT", "JGE", false },
+    { OP_GT, "gt", "JGT", "JLE", false }
+};
+// assembly code of the fragment
+static _Thread_local arena *asm_code;
+// scratch space for the label currently being written
+static _Thread_local arena *labels;
+// start of every generated label, which keeps fragments' labels apart
+static _Thread_local char label_prefix[VM_FILE_NAME_MAX_LEN];
+static _Thread_local char current_vm_file_name[VM_FILE_NAME_MAX_LEN];
+static _Thread_local hash_table *call_counts;
+static _Thread_local int eq_count;
+static _Thread_local int lt_count;
+static _Thread_local int gt_count;
+static _Thread_local int inline_count;
+static _Thread_local rom_count_mode count_mode;
+static _Thread_local unsigned rom_words;
+static _Thread_local unsigned inline_rom_words;
+static _Thread_local bool at_line_start;
+// with options.cache_tos, true while the top stack value is held in D rather
+// than in RAM[SP - 1]; SP then already excludes it
+static _Thread_local bool tos_in_d;
+// with options.fuse_moves, a push held back until the next command shows
+// whether it can be fused with a following pop
+static _Thread_local vm_instruction pending_push;
+static _Thread_local bool has_pending_push;
+static _Thread_local unsigned fused_moves;
+// with options.fold_constants, the commands of the function being read,
+// written once the function has been read and folded
+static _Thread_local vm_command *command_buffer;
+static _Thread_local unsigned num_buffered_commands;
+static _Thread_local unsigned command_buffer_capacity;
+static _Thread_local unsigned folded_commands;
+static _Thread_local offset_histogram offsets;
+// with options.fuse_branches, a comparison and an optional not held back
+// until the next command shows whether they feed an if-goto
+static _Thread_local const comparison *pending_comparison;
+static _Thread_local bool has_pending_not;
+static _Thread_local bool uses_shared_call;
+static _Thread_local bool uses_shared_return;
+// with static frames, the function being written if it has a static frame
+static _Thread_local const vm_function *current_frame;
+// while true, code is counted in discarded_rom_words and not written
+static _Thread_local bool discarding;
+static _Thread_local unsigned discarded_rom_words;
+// shared routine use saved when discarding starts, so that discarded code
+// does not cause routines to be written
+static _Thread_local bool saved_uses_shared_call;
+static _Thread_local bool saved_uses_shared_return;
+static _Thread_local bool saved_comparison_used[NUM_COMPARISONS];
+static _Thread_local unsigned saved_fused_moves;
 
 /*******************************************************************************
 ** Function: writer_init
 ** Description: Initializes writer to start writing assembly instructions. Opens
-**     assembly file for writing and initializes a hash table to keep track of
-**     how many times functions are called.
+**     assembly file for writing. Code is written in fragments, which are
+**     linked into the file in the order writer_link_fragment is called.
 ** Parameters:
 **     - asm_file_path: path of assembly file to write to
+**     - writer_options: code generation options to translate with
 ** Pre-Conditions: asm_file_path is non-null
-** Post-Conditions: asm_file and call_counts are non-null
+** Post-Conditions: asm_file is non-null
 *******************************************************************************/
-void writer_init(const char *asm_file_path) {
+void writer_init(const char *asm_file_path, writer_options writer_options) {
     asm_file = safe_fopen(asm_file_path, "w");
-    call_counts = hash_table_init(CALL_COUNT_TABLE_SIZE);
+    options = writer_options;
 }
 
 /*******************************************************************************
 ** Function: writer_dispose
-** Description: Frees all memory allocated to writer: closes assembly file
-**     and disposes of call count hash table
+** Description: Links a last fragment with the shared routines that any linked
+**     fragment jumps to, then closes the assembly file
 ** Parameters: void
-** Pre-Conditions: current_vm_file_name is allocated (set_current_vm_file_name
-**     has been called)
+** Pre-Conditions: writer_init has been called, no fragment is being written
 ** Post-Conditions: All memory allocated to writer is freed
 *******************************************************************************/
 void writer_dispose() {
+    asm_fragment shared_routines;
+    writer_begin_fragment("");
+    uses_shared_call = linked.uses_shared_call;
+    uses_shared_return = linked.uses_shared_return;
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        comparisons[i].used = linked.uses_comparison[i];
+    }
+    write_shared_routines();
+    writer_end_fragment(&shared_routines);
+    writer_link_fragment(&shared_routines);
     safe_fclose(asm_file);
+}
+
+/*******************************************************************************
+** Function: writer_begin_fragment
+** Description: Starts writing a fragment on the calling thread. Fragments are
+**     written independently of each other, so several threads may write one
+**     each at the same time. Every label the writer makes starts with
+**     prefix, and counters for labels start over, so a fragment's code
+**     does not depend on what else is translated.
+** Parameters:
+**     - prefix: Start of generated labels, unique to the fragment, or
+**         "" to leave generated labels unprefixed
+** Pre-Conditions: writer_init has been called, prefix is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+void writer_begin_fragment(const char *prefix) {
+    asm_code = arena_init(FRAGMENT_ARENA_LEN);
+    labels = arena_init(LABEL_ARENA_LEN);
+    call_counts = hash_table_init(CALL_COUNT_TABLE_SIZE);
+    strcpy(label_prefix, prefix);
+    current_vm_file_name[0] = '\0';
+    eq_count = lt_count = gt_count = inline_count = 0;
+    count_mode = COUNT_ALL;
+    rom_words = inline_rom_words = discarded_rom_words = fused_moves = 0;
+    folded_commands = 0;
+    memset(&offsets, 0, sizeof(offsets));
+    num_buffered_commands = 0;
+    at_line_start = true;
+    tos_in_d = has_pending_push = has_pending_not = false;
+    pending_comparison = NULL;
+    uses_shared_call = uses_shared_return = false;
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        comparisons[i].used = false;
+    }
+    current_frame = NULL;
+    discarding = false;
+}
+
+/*******************************************************************************
+** Function: writer_end_fragment
+** Description: Finishes the fragment being written on the calling thread and
+**     hands its code and counts over to fragment
+** Parameters:
+**     - fragment: Where to store the finished fragment
+** Pre-Conditions: writer_begin_fragment has been called on this thread,
+**     fragment is non-null
+** Post-Conditions: fragment->asm_code is owned by the caller
+*******************************************************************************/
+void writer_end_fragment(asm_fragment *fragment) {
+    flush_command_buffer();
+    flush_pending_commands();
+    spill_tos();
+    writer_set_discard(false);
+    fragment->asm_code = asm_code;
+    fragment->rom_words = rom_words;
+    fragment->inline_rom_words = inline_rom_words;
+    fragment->discarded_rom_words = discarded_rom_words;
+    fragment->fused_moves = fused_moves;
+    fragment->folded_commands = folded_commands;
+    fragment->offsets = offsets;
+    fragment->uses_shared_call = uses_shared_call;
+    fragment->uses_shared_return = uses_shared_return;
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        fragment->uses_comparison[i] = comparisons[i].used;
+    }
+    arena_dispose(labels);
     hash_table_dispose(call_counts);
+    free(command_buffer);
+    command_buffer = NULL;
+    command_buffer_capacity = 0;
+    asm_code = NULL;
+}
+
+/*******************************************************************************
+** Function: writer_link_fragment
+** Description: Writes a finished fragment to asm_file with one large write,
+**     adds its counts to the totals and frees its code
+** Parameters:
+**     - fragment: Fragment to link
+** Pre-Conditions: fragment was finished by writer_end_fragment
+** Post-Conditions: fragment->asm_code is freed
+*******************************************************************************/
+void writer_link_fragment(asm_fragment *fragment) {
+    arena *fragment_code = fragment->asm_code;
+    size_t written = fwrite(fragment_code->data, sizeof(char),
+            fragment_code->len, asm_file);
+    assert_condition(written == fragment_code->len,
+            "Error: could not write assembly file\n");
+    arena_dispose(fragment_code);
+    fragment->asm_code = NULL;
+    linked.rom_words += fragment->rom_words;
+    linked.inline_rom_words += fragment->inline_rom_words;
+    linked.discarded_rom_words += fragment->discarded_rom_words;
+    linked.fused_moves += fragment->fused_moves;
+    linked.folded_commands += fragment->folded_commands;
+    for (int segment = 0; segment < NUM_POINTER_SEGMENTS; segment++) {
+        for (int bucket = 0; bucket < NUM_OFFSET_BUCKETS; bucket++) {
+            linked.offsets.accesses[segment][bucket]
+                    += fragment->offsets.accesses[segment][bucket];
+            linked.offsets.saved_words[segment][bucket]
+                    += fragment->offsets.saved_words[segment][bucket];
+        }
+    }
+    linked.uses_shared_call |= fragment->uses_shared_call;
+    linked.uses_shared_return |= fragment->uses_shared_return;
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        linked.uses_comparison[i] |= fragment->uses_comparison[i];
+    }
+}
+
+/*******************************************************************************
+** Function: writer_fragment_key
+** Description: Returns a hash of everything that the code of a file's
+**     fragment depends on: the file's contents and name, the code generation
+**     options, DEBUG and the fragment format. Two files with the same key
+**     translate to the same fragment.
+** Parameters:
+**     - vm_code: Contents of the .vm file
+**     - vm_code_len: Number of characters in vm_code
+**     - vm_file_name: Name of the .vm file without extension
+** Pre-Conditions: writer_init has been called, vm_code and vm_file_name are
+**     non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+unsigned long long writer_fragment_key(const char *vm_code, size_t vm_code_len,
+        const char *vm_file_name) {
+    const int header[] = {
+        FRAGMENT_VERSION, DEBUG,
+        options.shared_calls, options.shared_comparisons, options.cache_tos,
+        options.fuse_moves, options.fuse_branches, options.fold_constants
+    };
+    unsigned long long key = hash_bytes(FNV_OFFSET_BASIS, header,
+            sizeof(header));
+    key = hash_bytes(key, vm_file_name, strlen(vm_file_name) + 1);
+    return hash_bytes(key, vm_code, vm_code_len);
+}
+
+/*******************************************************************************
+** Function: writer_save_fragment
+** Description: Writes a finished fragment's counts and code to file, so that a
+**     later run can link it without translating the file again
+** Parameters:
+**     - fragment: Fragment to save
+**     - file: File to save it to
+** Pre-Conditions: fragment was finished by writer_end_fragment and not yet
+**     linked, file is open for writing
+** Post-Conditions: N/A
+*******************************************************************************/
+void writer_save_fragment(const asm_fragment *fragment, FILE *file) {
+    fprintf(file, FRAGMENT_HEADER_FORMAT, FRAGMENT_VERSION, DEBUG);
+    fprintf(file, "%u %u %u %u %u %d %d", fragment->rom_words,
+            fragment->inline_rom_words, fragment->discarded_rom_words,
+            fragment->fused_moves, fragment->folded_commands,
+            fragment->uses_shared_call, fragment->uses_shared_return);
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        fprintf(file, " %d", fragment->uses_comparison[i]);
+    }
+    for (int segment = 0; segment < NUM_POINTER_SEGMENTS; segment++) {
+        for (int bucket = 0; bucket < NUM_OFFSET_BUCKETS; bucket++) {
+            fprintf(file, " %u %u",
+                    fragment->offsets.accesses[segment][bucket],
+                    fragment->offsets.saved_words[segment][bucket]);
+        }
+    }
+    fprintf(file, "\n");
+    fwrite(fragment->asm_code->data, sizeof(char), fragment->asm_code->len,
+            file);
+}
+
+/*******************************************************************************
+** Function: writer_load_fragment
+** Description: Reads a fragment saved by writer_save_fragment
+** Parameters:
+**     - fragment: Where to store the fragment
+**     - file: File to read it from
+** Pre-Conditions: fragment is non-null, file is open for reading
+** Post-Conditions: If return value is true, fragment can be linked as if it
+**     had been finished by writer_end_fragment. Otherwise the file was saved
+**     by another version or is damaged, and fragment is unchanged.
+*******************************************************************************/
+bool writer_load_fragment(asm_fragment *fragment, FILE *file) {
+    int version, debug;
+    if (fscanf(file, FRAGMENT_HEADER_FORMAT, &version, &debug) != 2
+            || version != FRAGMENT_VERSION || debug != DEBUG) {
+        return false;
+    }
+    asm_fragment loaded;
+    int uses_shared_call, uses_shared_return;
+    if (fscanf(file, "%u %u %u %u %u %d %d", &loaded.rom_words,
+            &loaded.inline_rom_words, &loaded.discarded_rom_words,
+            &loaded.fused_moves, &loaded.folded_commands, &uses_shared_call,
+            &uses_shared_return) != 7) {
+        return false;
+    }
+    loaded.uses_shared_call = uses_shared_call;
+    loaded.uses_shared_return = uses_shared_return;
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        int uses_comparison;
+        if (fscanf(file, "%d", &uses_comparison) != 1) {
+            return false;
+        }
+        loaded.uses_comparison[i] = uses_comparison;
+    }
+    for (int segment = 0; segment < NUM_POINTER_SEGMENTS; segment++) {
+        for (int bucket = 0; bucket < NUM_OFFSET_BUCKETS; bucket++) {
+            if (fscanf(file, "%u %u",
+                    &loaded.offsets.accesses[segment][bucket],
+                    &loaded.offsets.saved_words[segment][bucket]) != 2) {
+                return false;
+            }
+        }
+    }
+    if (fgetc(file) != '\n') {
+        return false;
+    }
+    loaded.asm_code = arena_init(FRAGMENT_READ_LEN);
+    char buffer[FRAGMENT_READ_LEN];
+    size_t read_len;
+    while ((read_len = fread(buffer, sizeof(char), FRAGMENT_READ_LEN, file))
+            > 0) {
+        arena_append(loaded.asm_code, buffer, read_len);
+    }
+    if (ferror(file)) {
+        arena_dispose(loaded.asm_code);
+        return false;
+    }
+    *fragment = loaded;
+    return true;
+}
+
+/*******************************************************************************
+** Function: writer_rom_words
+** Description: Returns the number of instructions written so far, i.e. the
+**     number of ROM words the assembled program will take
+** Parameters: void
+** Pre-Conditions: writer_init has been called
+** Post-Conditions: N/A
+*******************************************************************************/
+unsigned writer_rom_words() {
+    return linked.rom_words;
+}
+
+/*******************************************************************************
+** Function: writer_inline_rom_words
+** Description: Returns the number of ROM words the program would take if every
+**     call, return and comparison were written inline rather than through the
+**     shared routines
+** Parameters: void
+** Pre-Conditions: writer_init has been called
+** Post-Conditions: N/A
+*******************************************************************************/
+unsigned writer_inline_rom_words() {
+    return linked.inline_rom_words;
+}
+
+/*******************************************************************************
+** Function: writer_fused_moves
+** Description: Returns the number of push/pop pairs written as direct moves
+** Parameters: void
+** Pre-Conditions: writer_init has been called
+** Post-Conditions: N/A
+*******************************************************************************/
+unsigned writer_fused_moves() {
+    return linked.fused_moves;
+}
+
+/*******************************************************************************
+** Function: writer_folded_commands
+** Description: Returns the number of vm commands that constant folding has
+**     removed
+** Parameters: void
+** Pre-Conditions: writer_init has been called
+** Post-Conditions: N/A
+*******************************************************************************/
+unsigned writer_folded_commands() {
+    return linked.folded_commands;
+}
+
+/*******************************************************************************
+** Function: writer_offset_histogram
+** Description: Returns how often each offset into local, argument, this and
+**     that was accessed and how many ROM words reaching the entry with an
+**     A=M+1 chain saved
+** Parameters: void
+** Pre-Conditions: writer_init has been called
+** Post-Conditions: Return value is non-null
+*******************************************************************************/
+const offset_histogram *writer_offset_histogram() {
+    return &linked.offsets;
+}
+
+/*******************************************************************************
+** Function: writer_set_discard
+** Description: Starts or stops discarding code. Discarded code is translated as
+**     usual so that its size can be reported, but it is not written, is left
+**     out of the ROM size and fused move counts, and does not cause shared
+**     routines to be written. Any held back command is written before the
+**     switch so that it lands on the side it was read on.
+** Parameters:
+**     - discard: true to discard the code written from now on
+** Pre-Conditions: writer_init has been called
+** Post-Conditions: N/A
+*******************************************************************************/
+void writer_set_discard(bool discard) {
+    if (discard == discarding) {
+        return;
+    }
+    flush_command_buffer();
+    flush_pending_commands();
+    spill_tos();
+    if (discard) {
+        saved_uses_shared_call = uses_shared_call;
+        saved_uses_shared_return = uses_shared_return;
+        for (int i = 0; i < NUM_COMPARISONS; i++) {
+            saved_comparison_used[i] = comparisons[i].used;
+        }
+        saved_fused_moves = fused_moves;
+    } else {
+        uses_shared_call = saved_uses_shared_call;
+        uses_shared_return = saved_uses_shared_return;
+        for (int i = 0; i < NUM_COMPARISONS; i++) {
+            comparisons[i].used = saved_comparison_used[i];
+        }
+        fused_moves = saved_fused_moves;
+    }
+    discarding = discard;
+}
+
+/*******************************************************************************
+** Function: writer_discarded_rom_words
+** Description: Returns the number of ROM words of code that has been discarded
+** Parameters: void
+** Pre-Conditions: writer_init has been called
+** Post-Conditions: N/A
+*******************************************************************************/
+unsigned writer_discarded_rom_words() {
+    return linked.discarded_rom_words;
+}
+
+/*******************************************************************************
+** Function: writer_use_static_frames
+** Description: Makes calls to, and the code of, functions given a static frame
+**     by program_assign_static_frames use that frame. The stack starts after
+**     the frames.
+** Parameters:
+**     - program: Program whose frames have been assigned
+**     - frames_end: First address after the frames
+** Pre-Conditions: program is non-null, write_bootstrap has not been called
+** Post-Conditions: N/A
+*******************************************************************************/
+void writer_use_static_frames(const vm_program *program, unsigned frames_end) {
+    frame_program = program;
+    stack_start = frames_end;
 }
 
 /*******************************************************************************
 ** Function: write_bootstrap
-** Description: Writes assembly code to set stack pointer to 256, and then call
-**     the Sys.init subroutine
+** Description: Writes assembly code to set stack pointer to 256, or past any
+**     static frames, and then call the Sys.init subroutine
 ** Parameters: void
-** Pre-Conditions: asm_file is non-null (writer_init has been called)
-** Post-Conditions: Bootstrap code has been written to asm_file,
+** Pre-Conditions: writer_begin_fragment has been called
+** Post-Conditions: Bootstrap code has been written,
 **     current_vm_file_name has been set to "Sys"
 *******************************************************************************/
 void write_bootstrap() {
-    assert_nonnull(asm_file, "Error: Cannot write bootstrap to uninitialized "
-            "assembly file\n");
-    fprintf(asm_file, 
+    assert_nonnull(asm_code, "Error: Cannot write bootstrap outside of a "
+            "fragment\n");
+    write_asm(
             "// bootstrap code\n"
-            "@256\n"
+            "@%d\n"
             "D=A\n"
             "@SP\n"
             "M=D\n"
-            "\n"
+            "\n",
+            stack_start
     );
     set_current_vm_file_name("Sys");
     write_asm_instructions("call Sys.init 0");
@@ -157,113 +664,259 @@ void write_bootstrap() {
 ** Post-Conditions: N/A
 *******************************************************************************/
 void set_current_vm_file_name(const char *vm_file_name) {
+    flush_command_buffer();
+    flush_pending_commands();
+    current_frame = NULL;
     strcpy(current_vm_file_name, vm_file_name);
 }
 
 /*******************************************************************************
 ** Function: write_asm_instructions
-** Description: Writes the compiled assembly code for a given line of vm code
+** Description: Writes the compiled assembly code for a given line of vm code.
+**     With options.fold_constants, the line is buffered until the function
+**     it belongs to has been read.
 ** Parameters:
 **     - vm_line: line of vm code to compile
 ** Pre-Conditions: vm_line is non-null
-** Post-Conditions: Compiled assembly instructions have been writen to asm_file
+** Post-Conditions: Compiled assembly instructions have been written to the fragment
 *******************************************************************************/
 void write_asm_instructions(const char *vm_line) {
     assert_nonnull(vm_line, "Error: Cannot compile NULL vm line\n");
-    write_vm_comment(vm_line);
-    char operator[MAX_OPERATOR_LEN];
-    cmd_args args;
-    sscanf(vm_line, "%s %s %u", operator, args.operand, &(args.value));
-    const vm_command *cmd = get_vm_command(operator);
-    cmd->write_function(&args);
-    fprintf(asm_file, "\n");
+    vm_instruction args;
+    parse_vm_line(vm_line, &args);
+    if (!options.fold_constants) {
+        write_instruction(vm_line, &args);
+        return;
+    }
+    if (args.operator == OP_FUNCTION) {
+        flush_command_buffer();
+    }
+    buffer_command(vm_line, &args);
 }
 
 /*******************************************************************************
-** Function: write_vm_comment
-** Description: Writes a comment containing the contents of vm_line to asm_file
+** Function: buffer_command
+** Description: Appends a parsed line of vm code to command_buffer
 ** Parameters:
-**     - vm_line: Line of vm code to write a comment for
-** Pre-Conditions: vm_line is non-null
-** Post-Conditions: Comment containing vm_line has been written to asm_file
+**     - vm_line: line of vm code, for the comment
+**     - args: the parsed line
+** Pre-Conditions: vm_line and args are non-null
+** Post-Conditions: The command is the last one in command_buffer
 *******************************************************************************/
-static void write_vm_comment(const char *vm_line) {
-    fprintf(asm_file, "// %s\n", vm_line);
+static void buffer_command(const char *vm_line, const vm_instruction *args) {
+    if (num_buffered_commands == command_buffer_capacity) {
+        command_buffer_capacity = command_buffer_capacity
+                ? command_buffer_capacity * 2 : COMMAND_BUFFER_LEN;
+        command_buffer = realloc(command_buffer,
+                command_buffer_capacity * sizeof(vm_command));
+        assert_nonnull(command_buffer, "Error allocating memory");
+    }
+    vm_command *command = &command_buffer[num_buffered_commands++];
+    command->args = *args;
+    snprintf(command->vm_line, VM_COMMAND_LINE_LEN, "%s", vm_line);
 }
 
 /*******************************************************************************
-** Function: get_vm_command
-** Description: Returns vm_command matching the given operator
-** Parameters:
-**     - operator: name of the vm command to match
+** Function: flush_command_buffer
+** Description: Folds the buffered commands and writes them
+** Parameters: void
 ** Pre-Conditions: N/A
-** Post-Conditions: Return value is a valid vm_command
+** Post-Conditions: command_buffer is empty
 *******************************************************************************/
-static vm_command *get_vm_command(const char *operator) {
-    for (int cmd_index = 0; cmd_index < NUM_VM_OPERATORS; cmd_index++) {
-        if (strcmp(operator, cmd_list[cmd_index].name) == EXIT_SUCCESS) {
-            return cmd_list + cmd_index;
+static void flush_command_buffer() {
+    unsigned num_commands = num_buffered_commands;
+    num_buffered_commands = 0;
+    write_commands(command_buffer, num_commands);
+}
+
+/*******************************************************************************
+** Function: write_commands
+** Description: Folds constants in a run of commands and writes the commands
+**     that are left, counting the ones removed unless they are discarded
+** Parameters:
+**     - commands: Commands to write, overwritten by the folded commands
+**     - num_commands: Number of commands
+** Pre-Conditions: commands is non-null if num_commands > 0
+** Post-Conditions: The commands have been written
+*******************************************************************************/
+static void write_commands(vm_command *commands, unsigned num_commands) {
+    unsigned num_folded = fold_constants(commands, num_commands);
+    if (!discarding) {
+        folded_commands += num_commands - num_folded;
+    }
+    for (unsigned i = 0; i < num_folded; i++) {
+        write_instruction(commands[i].vm_line, &commands[i].args);
+    }
+}
+
+/*******************************************************************************
+** Function: write_instruction
+** Description: Writes the compiled assembly code for a parsed line of vm code,
+**     holding back commands that may be fused with the next one
+** Parameters:
+**     - vm_line: line of vm code, for the comment
+**     - args: the parsed line
+** Pre-Conditions: vm_line and args are non-null
+** Post-Conditions: Compiled assembly instructions have been written to the fragment
+*******************************************************************************/
+static void write_instruction(const char *vm_line,
+        const vm_instruction *args) {
+    if (has_pending_push && args->operator == OP_POP) {
+        write_vm_comment(vm_line);
+        write_move(&pending_push, args);
+        has_pending_push = false;
+    } else if (pending_comparison != NULL && !has_pending_not
+            && args->operator == OP_NOT) {
+        write_vm_comment(vm_line);
+        has_pending_not = true;
+    } else if (pending_comparison != NULL && args->operator == OP_IF_GOTO) {
+        write_vm_comment(vm_line);
+        write_branch(pending_comparison, has_pending_not, args->operand);
+        pending_comparison = NULL;
+        has_pending_not = false;
+    } else {
+        flush_pending_commands();
+        write_vm_comment(vm_line);
+        if (options.fuse_moves && args->operator == OP_PUSH) {
+            pending_push = *args;
+            has_pending_push = true;
+        } else if (options.fuse_branches
+                && (pending_comparison = find_comparison(args->operator))
+                != NULL) {
+            // held until the next command
+        } else {
+            command_writers[args->operator](args);
         }
     }
-    fprintf(stderr, "Error: invalid operator \"%s\"\n", operator);
-    exit(EXIT_FAILURE);
+#if DEBUG
+    write_asm("\n");
+#endif
+}
+
+/*******************************************************************************
+** Function: write_asm
+** Description: Appends formatted assembly code to the fragment and adds
+**     its instructions to the ROM size counters selected by count_mode. In
+**     COUNT_INLINE mode the code is only counted. Only the %s, %d and %c
+**     conversions are supported; integers are formatted without printf.
+** Parameters:
+**     - format: printf-style format of the assembly code to write
+** Pre-Conditions: asm_code is non-null (writer_begin_fragment has been
+**     called)
+** Post-Conditions: N/A
+*******************************************************************************/
+static void write_asm(const char *format, ...) {
+    size_t start = asm_code->len;
+    va_list format_args;
+    va_start(format_args, format);
+    const char *literal = format;
+    const char *c;
+    for (c = format; *c != '\0'; c++) {
+        if (*c != '%') {
+            continue;
+        }
+        arena_append(asm_code, literal, c - literal);
+        switch (*++c) {
+            case 's':
+                arena_append_string(asm_code, va_arg(format_args, char *));
+                break;
+            case 'd':
+                arena_append_int(asm_code, va_arg(format_args, int), 0);
+                break;
+            case 'c':
+                arena_append_char(asm_code, va_arg(format_args, int));
+                break;
+            default:
+                fprintf(stderr, "Error: unsupported conversion in "
+                        "assembly format \"%s\"\n", format);
+                exit(EXIT_FAILURE);
+        }
+        literal = c + 1;
+    }
+    arena_append(asm_code, literal, c - literal);
+    va_end(format_args);
+    count_rom_words(asm_code->data + start, asm_code->len - start);
+    if (count_mode == COUNT_INLINE || discarding) {
+        asm_code->len = start;
+    }
+}
+
+/*******************************************************************************
+** Function: count_rom_words
+** Description: Counts the instructions in a piece of assembly code. Every line
+**     that is not blank, a comment or a label becomes one ROM word. Code may
+**     be written a partial line at a time, so the position within the current
+**     line is kept between calls.
+** Parameters:
+**     - asm_code: assembly code to count
+**     - asm_code_len: number of characters of asm_code to count
+** Pre-Conditions: asm_code is non-null
+** Post-Conditions: rom_words, inline_rom_words and discarded_rom_words have
+**     been updated
+*******************************************************************************/
+static void count_rom_words(const char *asm_code, size_t asm_code_len) {
+    for (const char *c = asm_code; c < asm_code + asm_code_len; c++) {
+        if (at_line_start && *c != '\n' && *c != '/' && *c != '(') {
+            if (discarding) {
+                if (count_mode != COUNT_INLINE) {
+                    discarded_rom_words++;
+                }
+            } else if (count_mode != COUNT_INLINE) {
+                rom_words++;
+            }
+            if (count_mode != COUNT_SHARED && !discarding) {
+                inline_rom_words++;
+            }
+        }
+        at_line_start = *c == '\n';
+    }
+}
+
+/*******************************************************************************
+** Function: write_vm_comment
+** Description: Writes a comment containing the contents of vm_line to the
+**     fragment. Comments are left out of builds with DEBUG set to 0.
+** Parameters:
+**     - vm_line: Line of vm code to write a comment for
+** Pre-Conditions: vm_line is non-null
+** Post-Conditions: Comment containing vm_line has been written
+*******************************************************************************/
+static void write_vm_comment(const char *vm_line) {
+#if DEBUG
+    write_asm("// %s\n", vm_line);
+#endif
 }
 
 /*******************************************************************************
 ** Function: write_push
 ** Description: Writes compiled asm code for vm push operator
 ** Parameters:
-**     - args->operand: Memory segment to push from
+**     - args->segment: Memory segment to push from
 **     - args->value: Address offset from beginning of segment
-** Pre-Conditions: args and args->operand are non-null
+** Pre-Conditions: args is non-null
 ** Post-Conditions: Push asm instructions have been writen
 *******************************************************************************/
-static void write_push(const cmd_args *args) {
-    if (strcmp(args->operand, "local") == EXIT_SUCCESS) {
-        // push RAM[*segment_pointer + i]
-        write_push_segment("LCL", args->value);
-    } else if (strcmp(args->operand, "argument") == EXIT_SUCCESS) {
-        // push RAM[*segment_pointer + i]
-        write_push_segment("ARG", args->value);
-    } else if (strcmp(args->operand, "this") == EXIT_SUCCESS) {
-        // push RAM[*segment_pointer + i]
-        write_push_segment("THIS", args->value);
-    } else if (strcmp(args->operand, "that") == EXIT_SUCCESS) {
+static void write_push(const vm_instruction *args) {
+    if (options.cache_tos) {
+        write_cached_push(args);
+        return;
+    }
+    const char *segment_pointer = get_segment_pointer(args->segment);
+    if (segment_pointer != NULL) {
         // push RAM[*segment_pointer + i]
-        write_push_segment("THAT", args->value);
-    } else if (strcmp(args->operand, "constant") == EXIT_SUCCESS) {
+        write_push_segment(args->segment, args->value);
+    } else if (args->segment == SEG_CONSTANT) {
         // push i
-        fprintf(asm_file,
-                "@%d\n"
-                PUSH_A,
-                args->value
-        );
-    } else if (strcmp(args->operand, "static") == EXIT_SUCCESS) {
-        // push variable foo.i
-        fprintf(asm_file,
-                "@%s.%d\n"
-                PUSH_M,
-                current_vm_file_name, args->value
-        );
-    } else if (strcmp(args->operand, "temp") == EXIT_SUCCESS) {
-        // push RAM[*(5+i)]
-        fprintf(asm_file,
-                "@R%d\n"
+        write_load_constant(args->value);
+        write_asm(PUSH_D);
+    } else {
+        // push static foo.i, temp RAM[5 + i] or pointer this/that
+        char symbol[MAX_SYMBOL_LEN];
+        get_fixed_symbol(args, symbol);
+        write_asm(
+                "@%s\n"
                 PUSH_M,
-                TEMP_START + args->value
-        );
-    } else if (strcmp(args->operand, "pointer") == EXIT_SUCCESS) {
-        // 0 => push this
-        // 1 => push that
-        fprintf(asm_file, "@");
-        if (args->value == 0) {
-            fprintf(asm_file, "THIS");
-        } else if (args->value == 1) {
-            fprintf(asm_file, "THAT");
-        }
-        fprintf(asm_file,
-                "\n"
-                PUSH_M
+                symbol
         );
     }
 }
@@ -275,17 +928,22 @@ static void write_push(const cmd_args *args) {
 ** Parameters:
 **     - segment: Memory segment to push from
 **     - value: Adddress offset from begining of segment
-** Pre-Conditions: segment is non-null
+** Pre-Conditions: segment is addressed through a segment pointer
 ** Post-Conditions: Push asm instructions have been writen
 *******************************************************************************/
-static void write_push_segment(const char *segment, int value) {
-    fprintf(asm_file,
+static void write_push_segment(vm_segment segment, unsigned value) {
+    if (use_entry_chain(segment, value, LOAD_ADDRESS_WORDS)) {
+        write_entry_address(segment, value);
+        write_asm(PUSH_M);
+        return;
+    }
+    write_asm(
             "@%s\n"
             "D=M\n"
             "@%d\n"
             "A=D+A\n"
             PUSH_M,
-            segment, value
+            segment_pointers[segment], value
     );
 }
 
@@ -293,55 +951,29 @@ static void write_push_segment(const char *segment, int value) {
 ** Function: write_pop
 ** Description: Writes compiled asm code for vm pop operator
 ** Parameters:
-**     - args->operand: Memory segment to pop to
+**     - args->segment: Memory segment to pop to
 **     - args->value: Address offset from beginning of segment
-** Pre-Conditions: args and args->operand are non-null
+** Pre-Conditions: args is non-null
 ** Post-Conditions: Pop asm instructions have been writen
 *******************************************************************************/
-static void write_pop(const cmd_args *args) {
-    if (strcmp(args->operand, "local") == EXIT_SUCCESS) {
-        // pop RAM[*segment_pointer + i]
-        write_pop_segment("LCL", args->value);
-    } else if (strcmp(args->operand, "argument") == EXIT_SUCCESS) {
-        // pop RAM[*segment_pointer + i]
-        write_pop_segment("ARG", args->value);
-    } else if (strcmp(args->operand, "this") == EXIT_SUCCESS) {
-        // pop RAM[*segment_pointer + i]
-        write_pop_segment("THIS", args->value);
-    } else if (strcmp(args->operand, "that") == EXIT_SUCCESS) {
+static void write_pop(const vm_instruction *args) {
+    if (tos_in_d) {
+        write_cached_pop(args);
+        return;
+    }
+    const char *segment_pointer = get_segment_pointer(args->segment);
+    if (segment_pointer != NULL) {
         // pop RAM[*segment_pointer + i]
-        write_pop_segment("THAT", args->value);
-    } else if (strcmp(args->operand, "static") == EXIT_SUCCESS) {
-        // pop variable foo.i
-        fprintf(asm_file,
-                POP_D
-                "@%s.%d\n"
-                "M=D\n",
-                current_vm_file_name, args->value
-        );
-    } else if (strcmp(args->operand, "temp") == EXIT_SUCCESS) {
-        // pop RAM[*(5+i)]
-        fprintf(asm_file,
+        write_pop_segment(args->segment, args->value);
+    } else {
+        // pop static foo.i, temp RAM[5 + i] or pointer this/that
+        char symbol[MAX_SYMBOL_LEN];
+        get_fixed_symbol(args, symbol);
+        write_asm(
                 POP_D
-                "@R%d\n"
+                "@%s\n"
                 "M=D\n",
-                args->value + TEMP_START
-        );
-    } else if (strcmp(args->operand, "pointer") == EXIT_SUCCESS) {
-        // 0 => pop this
-        // 1 => pop that
-        fprintf(asm_file,
-                POP_D
-                "@"
-        );
-        if (args->value == 0) {
-            fprintf(asm_file, "THIS");
-        } else if (args->value == 1) {
-            fprintf(asm_file, "THAT");
-        }
-        fprintf(asm_file,
-                "\n"
-                "M=D\n"
+                symbol
         );
     }
 }
@@ -353,11 +985,17 @@ static void write_pop(const cmd_args *args) {
 ** Parameters:
 **     - segment: Memory segment to pop to
 **     - value: Adddress offset from begining of segment
-** Pre-Conditions: segment is non-null
+** Pre-Conditions: segment is addressed through a segment pointer
 ** Post-Conditions: Pop asm instructions have been writen
 *******************************************************************************/
-static void write_pop_segment(const char *segment, int value) {
-    fprintf(asm_file,
+static void write_pop_segment(vm_segment segment, unsigned value) {
+    if (use_entry_chain(segment, value, STORE_ADDRESS_WORDS)) {
+        write_asm(POP_D);
+        write_entry_address(segment, value);
+        write_asm("M=D\n");
+        return;
+    }
+    write_asm(
             "@%s\n"
             "D=M\n"
             "@%d\n"
@@ -368,18 +1006,347 @@ static void write_pop_segment(const char *segment, int value) {
             "@R13\n"
             "A=M\n"
             "M=D\n",
-            segment, value
+            segment_pointers[segment], value
     );
 }
 
+/*******************************************************************************
+** Function: use_entry_chain
+** Description: Decides whether to reach a segment entry with
+**     write_entry_address, which is shorter than computing its address for
+**     small offsets, and records the access in the offset histogram
+** Parameters:
+**     - segment: Memory segment of the entry
+**     - offset: Address offset from beginning of segment
+**     - address_words: Number of words the code that computes the address
+**         instead takes, not counting what both ways share
+** Pre-Conditions: segment is addressed through a segment pointer
+** Post-Conditions: Return value is true if the chain is shorter
+*******************************************************************************/
+static bool use_entry_chain(vm_segment segment, unsigned offset,
+        unsigned address_words) {
+    // @segment and A=M, or @segment, A=M+1 and offset - 1 times A=A+1
+    unsigned chain_words = offset == 0 ? 2 : offset + 1;
+    bool use_chain = chain_words < address_words;
+    if (!discarding) {
+        unsigned bucket = offset < NUM_OFFSET_BUCKETS - 1
+                ? offset : NUM_OFFSET_BUCKETS - 1;
+        offsets.accesses[segment][bucket]++;
+        if (use_chain) {
+            offsets.saved_words[segment][bucket]
+                    += address_words - chain_words;
+        }
+    }
+    return use_chain;
+}
+
+/*******************************************************************************
+** Function: write_entry_address
+** Description: Writes asm instructions that set A to the address of a segment
+**     entry by stepping from the segment pointer, leaving D untouched
+** Parameters:
+**     - segment: Memory segment of the entry
+**     - offset: Address offset from beginning of segment
+** Pre-Conditions: segment is addressed through a segment pointer
+** Post-Conditions: Address asm instructions have been writen
+*******************************************************************************/
+static void write_entry_address(vm_segment segment, unsigned offset) {
+    write_asm("@%s\n", segment_pointers[segment]);
+    if (offset == 0) {
+        write_asm("A=M\n");
+        return;
+    }
+    write_asm("A=M+1\n");
+    for (unsigned i = 1; i < offset; i++) {
+        write_asm("A=A+1\n");
+    }
+}
+
+/*******************************************************************************
+** Function: write_cached_push
+** Description: Writes push asm instructions that load the pushed value into D
+**     and keep it there as the new top of the stack. The previous top is first
+**     spilled to RAM if it was also held in D.
+** Parameters:
+**     - args->segment: Memory segment to push from
+**     - args->value: Address offset from beginning of segment
+** Pre-Conditions: args is non-null
+** Post-Conditions: Push asm instructions have been writen, tos_in_d is true
+*******************************************************************************/
+static void write_cached_push(const vm_instruction *args) {
+    spill_tos();
+    write_load(args);
+    tos_in_d = true;
+}
+
+/*******************************************************************************
+** Function: write_load
+** Description: Writes asm instructions that load a segment entry into D
+** Parameters:
+**     - args->segment: Memory segment to load from
+**     - args->value: Address offset from beginning of segment
+** Pre-Conditions: args is non-null
+** Post-Conditions: Load asm instructions have been writen
+*******************************************************************************/
+static void write_load(const vm_instruction *args) {
+    const char *segment_pointer = get_segment_pointer(args->segment);
+    if (segment_pointer != NULL
+            && use_entry_chain(args->segment, args->value,
+            LOAD_ADDRESS_WORDS)) {
+        write_entry_address(args->segment, args->value);
+        write_asm("D=M\n");
+    } else if (segment_pointer != NULL) {
+        write_asm(
+                "@%s\n"
+                "D=M\n"
+                "@%d\n"
+                "A=D+A\n"
+                "D=M\n",
+                segment_pointer, args->value
+        );
+    } else if (args->segment == SEG_CONSTANT) {
+        write_load_constant(args->value);
+    } else {
+        char symbol[MAX_SYMBOL_LEN];
+        get_fixed_symbol(args, symbol);
+        write_asm(
+                "@%s\n"
+                "D=M\n",
+                symbol
+        );
+    }
+}
+
+/*******************************************************************************
+** Function: write_cached_pop
+** Description: Writes pop asm instructions that store the top of the stack
+**     from D. For LCL, ARG, THIS and THAT the target address is found without
+**     losing the value: D = value + address, then A = D - value.
+** Parameters:
+**     - args->segment: Memory segment to pop to
+**     - args->value: Address offset from beginning of segment
+** Pre-Conditions: args is non-null, tos_in_d is true
+** Post-Conditions: Pop asm instructions have been writen, tos_in_d is false
+*******************************************************************************/
+static void write_cached_pop(const vm_instruction *args) {
+    const char *segment_pointer = get_segment_pointer(args->segment);
+    if (segment_pointer != NULL
+            && use_entry_chain(args->segment, args->value,
+            CACHED_STORE_ADDRESS_WORDS)) {
+        write_entry_address(args->segment, args->value);
+        write_asm("M=D\n");
+    } else if (segment_pointer != NULL) {
+        write_asm(
+                "@R13\n"
+                "M=D\n"
+                "@%s\n"
+                "D=D+M\n"
+                "@%d\n"
+                "D=D+A\n"
+                "@R13\n"
+                "A=M\n"
+                "A=D-A\n"
+                "M=D-A\n",
+                segment_pointer, args->value
+        );
+    } else {
+        char symbol[MAX_SYMBOL_LEN];
+        get_fixed_symbol(args, symbol);
+        write_asm(
+                "@%s\n"
+                "M=D\n",
+                symbol
+        );
+    }
+    tos_in_d = false;
+}
+
+/*******************************************************************************
+** Function: write_move
+** Description: Writes a push followed by a pop as a direct move from the
+**     source entry to the target entry, leaving the stack untouched. The
+**     constants -1, 0 and 1 are stored without going through D.
+** Parameters:
+**     - source: Arguments of the push
+**     - target: Arguments of the pop
+** Pre-Conditions: source and target are non-null
+** Post-Conditions: Move asm instructions have been writen
+*******************************************************************************/
+static void write_move(const vm_instruction *source, const vm_instruction *target) {
+    spill_tos();
+    fused_moves++;
+    bool is_constant = source->segment == SEG_CONSTANT;
+    if (!is_constant && source->segment == target->segment
+            && source->value == target->value) {
+        // pushing and popping the same entry leaves it unchanged
+        return;
+    }
+    bool is_small_constant = is_constant
+            && (source->value <= 1 || source->value == MINUS_ONE);
+    int small_constant = signed_word(source->value);
+    const char *target_pointer = get_segment_pointer(target->segment);
+    if (target_pointer != NULL && use_entry_chain(target->segment,
+            target->value, is_small_constant
+            ? LOAD_ADDRESS_WORDS : STORE_ADDRESS_WORDS)) {
+        if (is_small_constant) {
+            write_entry_address(target->segment, target->value);
+            write_asm("M=%d\n", small_constant);
+        } else {
+            write_load(source);
+            write_entry_address(target->segment, target->value);
+            write_asm("M=D\n");
+        }
+    } else if (target_pointer != NULL && is_small_constant) {
+        write_asm(
+                "@%s\n"
+                "D=M\n"
+                "@%d\n"
+                "A=D+A\n"
+                "M=%d\n",
+                target_pointer, target->value, small_constant
+        );
+    } else if (target_pointer != NULL) {
+        write_asm(
+                "@%s\n"
+                "D=M\n"
+                "@%d\n"
+                "D=D+A\n"
+                "@R13\n"
+                "M=D\n",
+                target_pointer, target->value
+        );
+        write_load(source);
+        write_asm(
+                "@R13\n"
+                "A=M\n"
+                "M=D\n"
+        );
+    } else {
+        char symbol[MAX_SYMBOL_LEN];
+        get_fixed_symbol(target, symbol);
+        if (is_small_constant) {
+            write_asm(
+                    "@%s\n"
+                    "M=%d\n",
+                    symbol, small_constant
+            );
+        } else {
+            write_load(source);
+            write_asm(
+                    "@%s\n"
+                    "M=D\n",
+                    symbol
+            );
+        }
+    }
+}
+
+/*******************************************************************************
+** Function: flush_pending_commands
+** Description: Writes the commands held back for fusion, if there are any
+** Parameters: void
+** Pre-Conditions: N/A
+** Post-Conditions: No commands are held back
+*******************************************************************************/
+static void flush_pending_commands() {
+    static const vm_instruction no_args;
+    if (has_pending_push) {
+        has_pending_push = false;
+        write_push(&pending_push);
+    }
+    if (pending_comparison != NULL) {
+        command_writers[pending_comparison->operator](&no_args);
+        pending_comparison = NULL;
+    }
+    if (has_pending_not) {
+        has_pending_not = false;
+        write_not(&no_args);
+    }
+}
+
+/*******************************************************************************
+** Function: spill_tos
+** Description: Pushes the top of the stack from D to RAM if it is held in D.
+**     Called wherever control can arrive from or leave for other code, which
+**     expects the whole stack in RAM.
+** Parameters: void
+** Pre-Conditions: N/A
+** Post-Conditions: tos_in_d is false
+*******************************************************************************/
+static void spill_tos() {
+    if (tos_in_d) {
+        write_asm(PUSH_D);
+        tos_in_d = false;
+    }
+}
+
+/*******************************************************************************
+** Function: get_segment_pointer
+** Description: Returns the register holding the base address of a segment, or
+**     NULL if its entries are at fixed addresses. Local and argument entries
+**     are fixed inside a function with a static frame.
+** Parameters:
+**     - segment: Memory segment
+** Pre-Conditions: N/A
+** Post-Conditions: N/A
+*******************************************************************************/
+static const char *get_segment_pointer(vm_segment segment) {
+    if (current_frame != NULL
+            && (segment == SEG_LOCAL || segment == SEG_ARGUMENT)) {
+        return NULL;
+    }
+    return segment_pointers[segment];
+}
+
+/*******************************************************************************
+** Function: get_fixed_symbol
+** Description: Writes the symbol of the RAM word a static, temp or pointer
+**     segment entry, or a local or argument in a static frame, lives in
+** Parameters:
+**     - args->segment: Memory segment (static, temp or pointer)
+**     - args->value: Address offset from beginning of segment
+**     - symbol: buffer of at least MAX_SYMBOL_LEN characters
+** Pre-Conditions: args and symbol are non-null
+** Post-Conditions: symbol holds the null-terminated symbol
+*******************************************************************************/
+static void get_fixed_symbol(const vm_instruction *args, char *symbol) {
+    switch (args->segment) {
+        case SEG_STATIC:
+            sprintf(symbol, "%s.%d", current_vm_file_name, args->value);
+            break;
+        case SEG_TEMP:
+            sprintf(symbol, "R%d", TEMP_START + args->value);
+            break;
+        case SEG_POINTER:
+            strcpy(symbol, args->value == 0 ? "THIS" : "THAT");
+            break;
+        case SEG_ARGUMENT:
+            sprintf(symbol, "%u", current_frame->frame_base + args->value);
+            break;
+        case SEG_LOCAL:
+            sprintf(symbol, "%u", current_frame->frame_base
+                    + current_frame->num_args + args->value);
+            break;
+        default:
+            fprintf(stderr, "Error: segment has no fixed address\n");
+            exit(EXIT_FAILURE);
+    }
+}
+
 /*******************************************************************************
 ** Function: write_add
 ** Description: Writes compiled asm code for vm add operator
-** Parameters: unused
+** Parameters:
+**     - args->segment: SEG_CONSTANT if folding gave it a constant operand
+**     - args->value: The constant operand
 ** Pre-Conditions: N/A
 ** Post-Conditions: Add asm instructions have been writen
 *******************************************************************************/
-static void write_add(__attribute__((unused)) const cmd_args *args) {
+static void write_add(const vm_instruction *args) {
+    if (args->segment == SEG_CONSTANT) {
+        write_constant_operation('+', args->value);
+        return;
+    }
     write_binary_operation('+');
 }
 
@@ -390,7 +1357,7 @@ static void write_add(__attribute__((unused)) const cmd_args *args) {
 ** Pre-Conditions: N/A
 ** Post-Conditions: Sub asm instructions have been writen
 *******************************************************************************/
-static void write_sub(__attribute__((unused)) const cmd_args *args) {
+static void write_sub(__attribute__((unused)) const vm_instruction *args) {
     write_binary_operation('-');
 }
 
@@ -401,8 +1368,12 @@ static void write_sub(__attribute__((unused)) const cmd_args *args) {
 ** Pre-Conditions: N/A
 ** Post-Conditions: Neg asm instructions have been writen
 *******************************************************************************/
-static void write_neg(__attribute__((unused)) const cmd_args *args) {
-    fprintf(asm_file,
+static void write_neg(__attribute__((unused)) const vm_instruction *args) {
+    if (tos_in_d) {
+        write_asm("D=-D\n");
+        return;
+    }
+    write_asm(
             "@SP\n"
             "A=M-1\n"
             "M=-M\n"
@@ -416,8 +1387,7 @@ static void write_neg(__attribute__((unused)) const cmd_args *args) {
 ** Pre-Conditions: N/A
 ** Post-Conditions: Eq asm instructions have been writen
 *******************************************************************************/
-static void write_eq(__attribute__((unused)) const cmd_args *args) {
-    static int eq_count = 0;
+static void write_eq(__attribute__((unused)) const vm_instruction *args) {
     write_comparison("JEQ", eq_count);
     eq_count++;
 }
@@ -429,8 +1399,7 @@ static void write_eq(__attribute__((unused)) const cmd_args *args) {
 ** Pre-Conditions: N/A
 ** Post-Conditions: Lt asm instructions have been writen
 *******************************************************************************/
-static void write_lt(__attribute__((unused)) const cmd_args *args) {
-    static int lt_count = 0;
+static void write_lt(__attribute__((unused)) const vm_instruction *args) {
     write_comparison("JLT", lt_count);
     lt_count++;
 }
@@ -442,8 +1411,7 @@ static void write_lt(__attribute__((unused)) const cmd_args *args) {
 ** Pre-Conditions: N/A
 ** Post-Conditions: Gt asm instructions have been writen
 *******************************************************************************/
-static void write_gt(__attribute__((unused)) const cmd_args *args) {
-    static int gt_count = 0;
+static void write_gt(__attribute__((unused)) const vm_instruction *args) {
     write_comparison("JGT", gt_count);
     gt_count++;
 }
@@ -451,22 +1419,34 @@ static void write_gt(__attribute__((unused)) const cmd_args *args) {
 /*******************************************************************************
 ** Function: write_and
 ** Description: Writes compiled asm code for vm and operator
-** Parameters: unused
+** Parameters:
+**     - args->segment: SEG_CONSTANT if folding gave it a constant operand
+**     - args->value: The constant operand
 ** Pre-Conditions: N/A
 ** Post-Conditions: And asm instructions have been writen
 *******************************************************************************/
-static void write_and(__attribute__((unused)) const cmd_args *args) {
+static void write_and(const vm_instruction *args) {
+    if (args->segment == SEG_CONSTANT) {
+        write_constant_operation('&', args->value);
+        return;
+    }
     write_binary_operation('&');
 }
 
 /*******************************************************************************
 ** Function: write_or
 ** Description: Writes compiled asm code for vm or operator
-** Parameters: unused
+** Parameters:
+**     - args->segment: SEG_CONSTANT if folding gave it a constant operand
+**     - args->value: The constant operand
 ** Pre-Conditions: N/A
 ** Post-Conditions: Or asm instructions have been writen
 *******************************************************************************/
-static void write_or(__attribute__((unused)) const cmd_args *args) {
+static void write_or(const vm_instruction *args) {
+    if (args->segment == SEG_CONSTANT) {
+        write_constant_operation('|', args->value);
+        return;
+    }
     write_binary_operation('|');
 }
 
@@ -477,8 +1457,12 @@ static void write_or(__attribute__((unused)) const cmd_args *args) {
 ** Pre-Conditions: N/A
 ** Post-Conditions: Not asm instructions have been writen
 *******************************************************************************/
-static void write_not(__attribute__((unused)) const cmd_args *args) {
-    fprintf(asm_file,
+static void write_not(__attribute__((unused)) const vm_instruction *args) {
+    if (tos_in_d) {
+        write_asm("D=!D\n");
+        return;
+    }
+    write_asm(
             "@SP\n"
             "A=M-1\n"
             "M=!M\n"
@@ -493,8 +1477,9 @@ static void write_not(__attribute__((unused)) const cmd_args *args) {
 ** Pre-Conditions: args and args->operand are non-null
 ** Post-Conditions: Label asm instruction has been writen
 *******************************************************************************/
-static void write_label(const cmd_args *args) {
-    fprintf(asm_file, "(%s)\n", args->operand);
+static void write_label(const vm_instruction *args) {
+    spill_tos();
+    write_asm("(%s)\n", args->operand);
 }
 
 /*******************************************************************************
@@ -505,8 +1490,9 @@ static void write_label(const cmd_args *args) {
 ** Pre-Conditions: args and args->operand are non-null
 ** Post-Conditions: Goto asm instructions have been writen
 *******************************************************************************/
-static void write_goto(const cmd_args *args) {
-    fprintf(asm_file,
+static void write_goto(const vm_instruction *args) {
+    spill_tos();
+    write_asm(
             "@%s\n"
             "0;JMP\n",
             args->operand
@@ -521,8 +1507,17 @@ static void write_goto(const cmd_args *args) {
 ** Pre-Conditions: args and args->operand are non-null
 ** Post-Conditions: If-goto asm instructions have been writen
 *******************************************************************************/
-static void write_if_goto(const cmd_args *args) {
-    fprintf(asm_file,
+static void write_if_goto(const vm_instruction *args) {
+    if (tos_in_d) {
+        write_asm(
+                "@%s\n"
+                "D;JNE\n",
+                args->operand
+        );
+        tos_in_d = false;
+        return;
+    }
+    write_asm(
             POP_D
             "@%s\n"
             "D;JNE\n",
@@ -539,11 +1534,45 @@ static void write_if_goto(const cmd_args *args) {
 ** Pre-Conditions: args and args->operand are non-null
 ** Post-Conditions: Call asm instruction has been writen
 *******************************************************************************/
-static void write_call(const cmd_args *args) {
+static void write_call(const vm_instruction *args) {
     const char *function_name = args->operand;
     int num_args = args->value;
-    char *return_label = get_return_label(function_name);
-    fprintf(asm_file,
+    const vm_function *callee = find_static_frame(function_name);
+    if (callee != NULL && callee->inlined) {
+        write_inlined_call(callee, num_args);
+        return;
+    }
+    const char *return_label = get_return_label(function_name);
+    if (callee != NULL) {
+        write_static_call(callee, num_args, return_label);
+        return;
+    }
+    spill_tos();
+    if (options.shared_calls) {
+        count_mode = COUNT_INLINE;
+        write_inline_call(function_name, num_args, return_label);
+        count_mode = COUNT_SHARED;
+        write_shared_call(function_name, num_args, return_label);
+        count_mode = COUNT_ALL;
+    } else {
+        write_inline_call(function_name, num_args, return_label);
+    }
+}
+
+/*******************************************************************************
+** Function: write_inline_call
+** Description: Writes the full calling sequence: pushes the caller's frame,
+**     repositions LCL and ARG and jumps to the called function
+** Parameters:
+**     - function_name: Name of function to call
+**     - num_args: Number of arguments in called function
+**     - return_label: Label to return to after the call
+** Pre-Conditions: function_name and return_label are non-null
+** Post-Conditions: Call asm instructions have been written
+*******************************************************************************/
+static void write_inline_call(const char *function_name, int num_args,
+        const char *return_label) {
+    write_asm(
             // push return_label
             "@%s\n"
             PUSH_A
@@ -576,7 +1605,40 @@ static void write_call(const cmd_args *args) {
             "(%s)\n",
             return_label, 5 + num_args, function_name, return_label
     );
-    free(return_label);
+}
+
+/*******************************************************************************
+** Function: write_shared_call
+** Description: Writes a call through the shared call routine, which does the
+**     work of write_inline_call once for the whole program. The routine takes
+**     5 + num_args in R14, the return address in R15 and the function address
+**     in D, which it keeps in R13.
+** Parameters:
+**     - function_name: Name of function to call
+**     - num_args: Number of arguments in called function
+**     - return_label: Label to return to after the call
+** Pre-Conditions: function_name and return_label are non-null
+** Post-Conditions: Call asm instructions have been written
+*******************************************************************************/
+static void write_shared_call(const char *function_name, int num_args,
+        const char *return_label) {
+    write_asm(
+            "@%d\n"
+            "D=A\n"
+            "@R14\n"
+            "M=D\n"
+            "@%s\n"
+            "D=A\n"
+            "@R15\n"
+            "M=D\n"
+            "@%s\n"
+            "D=A\n"
+            "@" SHARED_CALL_LABEL "\n"
+            "0;JMP\n"
+            "(%s)\n",
+            5 + num_args, return_label, function_name, return_label
+    );
+    uses_shared_call = true;
 }
 
 /*******************************************************************************
@@ -588,11 +1650,21 @@ static void write_call(const cmd_args *args) {
 ** Pre-Conditions: args and args->operand are non-null
 ** Post-Conditions: Function asm instruction has been writen
 *******************************************************************************/
-static void write_function(const cmd_args *args) {
-    static const cmd_args constant_zero = {"constant", 0};
+static void write_function(const vm_instruction *args) {
+    spill_tos();
+    static const vm_instruction constant_zero = {
+        .operator = OP_PUSH,
+        .segment = SEG_CONSTANT,
+        .value = 0
+    };
     const char *function_name = args->operand;
     int num_vars = args->value;
-    fprintf(asm_file, "(%s)\n", function_name);
+    current_frame = find_static_frame(function_name);
+    if (current_frame != NULL) {
+        write_static_function(current_frame);
+        return;
+    }
+    write_asm("(%s)\n", function_name);
     for (int i = 0; i < num_vars; i++) {
         write_push(&constant_zero);
     }
@@ -605,8 +1677,37 @@ static void write_function(const cmd_args *args) {
 ** Pre-Conditions: N/A
 ** Post-Conditions: Return asm instruction has been writen
 *******************************************************************************/
-static void write_return(__attribute__((unused)) const cmd_args *args) {
-    fprintf(asm_file,
+static void write_return(__attribute__((unused)) const vm_instruction *args) {
+    if (current_frame != NULL) {
+        write_static_return();
+        return;
+    }
+    spill_tos();
+    if (options.shared_calls) {
+        count_mode = COUNT_INLINE;
+        write_inline_return();
+        count_mode = COUNT_SHARED;
+        write_asm(
+                "@" SHARED_RETURN_LABEL "\n"
+                "0;JMP\n"
+        );
+        count_mode = COUNT_ALL;
+        uses_shared_return = true;
+    } else {
+        write_inline_return();
+    }
+}
+
+/*******************************************************************************
+** Function: write_inline_return
+** Description: Writes the full return sequence: moves the return value to the
+**     caller's stack, restores the caller's frame and jumps back to it
+** Parameters: void
+** Pre-Conditions: N/A
+** Post-Conditions: Return asm instructions have been written
+*******************************************************************************/
+static void write_inline_return() {
+    write_asm(
             // end_frame = LCL
             "@LCL\n"
             "D=M\n"
@@ -663,6 +1764,375 @@ static void write_return(__attribute__((unused)) const cmd_args *args) {
     );
 }
 
+/*******************************************************************************
+** Function: write_static_call
+** Description: Writes a call to a function with a static frame: pops the
+**     arguments into the frame, stores the return address in it and jumps to
+**     the function. The function returns with its return value in D, which is
+**     pushed, or with cache_tos kept in D.
+** Parameters:
+**     - callee: Function to call
+**     - num_args: Number of arguments passed
+**     - return_label: Label to return to after the call
+** Pre-Conditions: callee and return_label are non-null, callee has a static
+**     frame
+** Post-Conditions: Call asm instructions have been written
+*******************************************************************************/
+static void write_static_call(const vm_function *callee, int num_args,
+        const char *return_label) {
+    unsigned frame_base = callee->frame_base;
+    write_frame_arguments(callee, num_args);
+    write_asm(
+            "@%s\n"
+            "D=A\n"
+            "@%d\n"
+            "M=D\n"
+            "@%s\n"
+            "0;JMP\n"
+            "(%s)\n",
+            return_label, frame_base + callee->num_args + callee->num_locals,
+            callee->name, return_label
+    );
+    if (options.cache_tos) {
+        tos_in_d = true;
+    } else {
+        write_asm(PUSH_D);
+    }
+}
+
+/*******************************************************************************
+** Function: write_static_function
+** Description: Writes the entry of a function with a static frame: clears its
+**     locals and saves THIS and THAT if the function changes them
+** Parameters:
+**     - function: Function to write the entry of
+** Pre-Conditions: function is non-null and has a static frame
+** Post-Conditions: Function asm instructions have been written
+*******************************************************************************/
+static void write_static_function(const vm_function *function) {
+    write_asm("(%s)\n", function->name);
+    write_frame_entry(function);
+}
+
+/*******************************************************************************
+** Function: write_static_return
+** Description: Writes the return of the function being written, which has a
+**     static frame: restores THIS and THAT if it saved them, pops the return
+**     value into D and jumps to the return address in the frame. Unlike the
+**     dynamic return, SP is not reset, so the stack must hold only the return
+**     value, as it does in code from the Jack compiler.
+** Parameters: void
+** Pre-Conditions: current_frame is non-null
+** Post-Conditions: Return asm instructions have been written
+*******************************************************************************/
+static void write_static_return() {
+    unsigned return_address = current_frame->frame_base
+            + current_frame->num_args + current_frame->num_locals;
+    write_frame_exit(current_frame);
+    if (!tos_in_d) {
+        write_asm(POP_D);
+    }
+    tos_in_d = false;
+    write_asm(
+            "@%d\n"
+            "A=M\n"
+            "0;JMP\n",
+            return_address
+    );
+}
+
+/*******************************************************************************
+** Function: write_frame_arguments
+** Description: Pops the arguments of a call into the static frame of the
+**     function called
+** Parameters:
+**     - callee: Function called
+**     - num_args: Number of arguments passed
+** Pre-Conditions: callee is non-null and has a static frame
+** Post-Conditions: Argument asm instructions have been written
+*******************************************************************************/
+static void write_frame_arguments(const vm_function *callee, int num_args) {
+    unsigned frame_base = callee->frame_base;
+    if (tos_in_d && num_args > 0) {
+        // the last argument is already in D
+        num_args--;
+        write_asm(
+                "@%d\n"
+                "M=D\n",
+                frame_base + num_args
+        );
+        tos_in_d = false;
+    }
+    spill_tos();
+    for (int i = num_args - 1; i >= 0; i--) {
+        write_asm(
+                POP_D
+                "@%d\n"
+                "M=D\n",
+                frame_base + i
+        );
+    }
+}
+
+/*******************************************************************************
+** Function: write_frame_entry
+** Description: Clears the locals in a static frame and saves THIS and THAT if
+**     the function changes them
+** Parameters:
+**     - function: Function being entered
+** Pre-Conditions: function is non-null and has a static frame
+** Post-Conditions: Entry asm instructions have been written
+*******************************************************************************/
+static void write_frame_entry(const vm_function *function) {
+    unsigned locals_base = function->frame_base + function->num_args;
+    unsigned save_address = locals_base + function->num_locals + 1;
+    for (unsigned i = 0; i < function->num_locals; i++) {
+        write_asm(
+                "@%d\n"
+                "M=0\n",
+                locals_base + i
+        );
+    }
+    if (function->sets_this) {
+        write_asm(
+                "@THIS\n"
+                "D=M\n"
+                "@%d\n"
+                "M=D\n",
+                save_address++
+        );
+    }
+    if (function->sets_that) {
+        write_asm(
+                "@THAT\n"
+                "D=M\n"
+                "@%d\n"
+                "M=D\n",
+                save_address
+        );
+    }
+}
+
+/*******************************************************************************
+** Function: write_frame_exit
+** Description: Restores THIS and THAT from a static frame if the function
+**     saved them on entry
+** Parameters:
+**     - function: Function being left
+** Pre-Conditions: function is non-null and has a static frame
+** Post-Conditions: Exit asm instructions have been written
+*******************************************************************************/
+static void write_frame_exit(const vm_function *function) {
+    unsigned save_address = function->frame_base + function->num_args
+            + function->num_locals + 1;
+    if (function->sets_this || function->sets_that) {
+        spill_tos();
+    }
+    if (function->sets_this) {
+        write_asm(
+                "@%d\n"
+                "D=M\n"
+                "@THIS\n"
+                "M=D\n",
+                save_address++
+        );
+    }
+    if (function->sets_that) {
+        write_asm(
+                "@%d\n"
+                "D=M\n"
+                "@THAT\n"
+                "M=D\n",
+                save_address
+        );
+    }
+}
+
+/*******************************************************************************
+** Function: write_inlined_call
+** Description: Writes the body of a function in place of a call to it. The
+**     arguments are popped into the function's static frame and its local and
+**     argument entries refer to that frame, as they would in the function
+**     itself. Labels get a suffix that is unique to the call site, and a
+**     return before the last command becomes a jump past the body; the return
+**     value is left on the stack either way.
+** Parameters:
+**     - callee: Function to inline
+**     - num_args: Number of arguments passed
+** Pre-Conditions: callee is non-null, has a static frame and is inlined
+** Post-Conditions: Body asm instructions have been written
+*******************************************************************************/
+static void write_inlined_call(const vm_function *callee, int num_args) {
+    char caller_file_name[VM_FILE_NAME_MAX_LEN];
+    const vm_function *caller_frame = current_frame;
+    int inline_id = inline_count++;
+    vm_instruction exit_label = { .operator = OP_LABEL };
+    int exit_label_len = snprintf(exit_label.operand, MAX_OPERAND_LEN,
+            "%s$inl.%d", callee->name, inline_id);
+    assert_condition(exit_label_len < MAX_OPERAND_LEN,
+            "Error: function name `%s' too long to inline\n", callee->name);
+    bool has_early_return = false;
+    vm_command *body = safe_malloc(callee->num_lines * sizeof(vm_command));
+    unsigned body_len = 0;
+
+    write_frame_arguments(callee, num_args);
+    strcpy(caller_file_name, current_vm_file_name);
+    strcpy(current_vm_file_name, frame_program->file_names[callee->file_index]);
+    current_frame = callee;
+    write_frame_entry(callee);
+    // lines[0] is the function command
+    for (unsigned i = 1; i < callee->num_lines; i++) {
+        const char *vm_line = callee->lines[i];
+        vm_instruction args;
+        parse_vm_line(vm_line, &args);
+        if (args.operator == OP_RETURN) {
+            if (i + 1 < callee->num_lines) {
+                args = exit_label;
+                args.operator = OP_GOTO;
+                has_early_return = true;
+            } else {
+                continue;
+            }
+        } else if (args.operator == OP_LABEL || args.operator == OP_GOTO
+                || args.operator == OP_IF_GOTO) {
+            char label[MAX_OPERAND_LEN];
+            int label_len = snprintf(label, MAX_OPERAND_LEN, "%s$%d",
+                    args.operand, inline_id);
+            assert_condition(label_len < MAX_OPERAND_LEN,
+                    "Error: label `%s' too long to inline\n", args.operand);
+            strcpy(args.operand, label);
+        }
+        body[body_len].args = args;
+        snprintf(body[body_len].vm_line, VM_COMMAND_LINE_LEN, "%s", vm_line);
+        body_len++;
+    }
+    if (options.fold_constants) {
+        write_commands(body, body_len);
+    } else {
+        for (unsigned i = 0; i < body_len; i++) {
+            write_instruction(body[i].vm_line, &body[i].args);
+        }
+    }
+    free(body);
+    flush_pending_commands();
+    if (has_early_return) {
+        write_label(&exit_label);
+    }
+    write_frame_exit(callee);
+    current_frame = caller_frame;
+    strcpy(current_vm_file_name, caller_file_name);
+}
+
+/*******************************************************************************
+** Function: find_static_frame
+** Description: Returns the function with the given name if static frames are
+**     in use and it has one, or NULL otherwise
+** Parameters:
+**     - function_name: Name of the function
+** Pre-Conditions: function_name is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static const vm_function *find_static_frame(const char *function_name) {
+    if (frame_program == NULL) {
+        return NULL;
+    }
+    const vm_function *function = program_find_function(frame_program,
+            function_name);
+    if (function == NULL || !function->has_static_frame) {
+        return NULL;
+    }
+    return function;
+}
+
+/*******************************************************************************
+** Function: write_shared_routines
+** Description: Writes the shared call, return and comparison routines that
+**     write_shared_call, write_return and write_comparison jumped to.
+**     The routines come after all translated code, which never falls through
+**     its last return or goto.
+** Parameters: void
+** Pre-Conditions: writer_begin_fragment has been called
+** Post-Conditions: Shared routines have been written
+*******************************************************************************/
+static void write_shared_routines() {
+    count_mode = COUNT_SHARED;
+    if (uses_shared_call) {
+        write_asm(
+                "// shared call routine\n"
+                "(" SHARED_CALL_LABEL ")\n"
+                "@R13\n"
+                "M=D\n"
+                // push return address
+                "@R15\n"
+                PUSH_M
+                // push LCL
+                "@LCL\n"
+                PUSH_M
+                // push ARG
+                "@ARG\n"
+                PUSH_M
+                // push THIS
+                "@THIS\n"
+                PUSH_M
+                // push THAT
+                "@THAT\n"
+                PUSH_M
+                // LCL = SP
+                "@SP\n"
+                "D=M\n"
+                "@LCL\n"
+                "M=D\n"
+                // ARG = SP - (5 + num_args)
+                "@R14\n"
+                "D=D-M\n"
+                "@ARG\n"
+                "M=D\n"
+                // goto function
+                "@R13\n"
+                "A=M\n"
+                "0;JMP\n"
+                "\n"
+        );
+    }
+    if (uses_shared_return) {
+        write_asm(
+                "// shared return routine\n"
+                "(" SHARED_RETURN_LABEL ")\n"
+        );
+        write_inline_return();
+        write_asm("\n");
+    }
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        if (!comparisons[i].used) {
+            continue;
+        }
+        // the return address is passed in D
+        write_asm(
+                "// shared %s routine\n"
+                "($%s)\n"
+                "@R15\n"
+                "M=D\n"
+                POP_D
+                "A=A-1\n"
+                "D=M-D\n"
+                "M=-1\n"
+                "@$%s.true\n"
+                "D;%s\n"
+                "@SP\n"
+                "A=M-1\n"
+                "M=0\n"
+                "($%s.true)\n"
+                "@R15\n"
+                "A=M\n"
+                "0;JMP\n"
+                "\n",
+                comparisons[i].name, comparisons[i].name, comparisons[i].name,
+                comparisons[i].jump_code, comparisons[i].name
+        );
+    }
+    count_mode = COUNT_ALL;
+}
+
 /*******************************************************************************
 ** Function: write_binary_operation
 ** Description: Writes compiled assembly code to perform a binary operation,
@@ -674,7 +2144,20 @@ static void write_return(__attribute__((unused)) const cmd_args *args) {
 **     written
 *******************************************************************************/
 static void write_binary_operation(const char binary_operator) {
-    fprintf(asm_file,
+    if (tos_in_d) {
+        // x is popped from RAM, y is in D and the result stays in D
+        write_asm(
+                "@SP\n"
+                "AM=M-1\n"
+        );
+        if (binary_operator == '-') {
+            write_asm("D=M-D\n");
+        } else {
+            write_asm("D=D%cM\n", binary_operator);
+        }
+        return;
+    }
+    write_asm(
             POP_D
             "A=A-1\n"
             "M=M%cD\n",
@@ -682,6 +2165,93 @@ static void write_binary_operation(const char binary_operator) {
     );
 }
 
+/*******************************************************************************
+** Function: write_load_constant
+** Description: Writes asm instructions that load a constant word into D. Words
+**     outside 0..32767 only come from constant folding; they are loaded
+**     through a negation or not of an A-instruction.
+** Parameters:
+**     - value: Word to load
+** Pre-Conditions: value <= WORD_MASK
+** Post-Conditions: Load asm instructions have been writen
+*******************************************************************************/
+static void write_load_constant(unsigned value) {
+    unsigned negated = -value & WORD_MASK;
+    if (value <= MAX_CONSTANT) {
+        write_asm(
+                "@%d\n"
+                "D=A\n",
+                value
+        );
+    } else if (value == MINUS_ONE) {
+        write_asm("D=-1\n");
+    } else if (negated <= MAX_CONSTANT) {
+        write_asm(
+                "@%d\n"
+                "D=-A\n",
+                negated
+        );
+    } else {
+        // -32768 = !32767
+        write_asm(
+                "@%d\n"
+                "D=!A\n",
+                MAX_CONSTANT
+        );
+    }
+}
+
+/*******************************************************************************
+** Function: write_constant_operation
+** Description: Writes compiled assembly code to add, and or or a constant to
+**     the top of the stack in place. Adding 1 or -1 needs no constant at all.
+** Parameters:
+**     - binary_operator: Symbol of the operation, one of +, & and |
+**     - value: Constant second operand
+** Pre-Conditions: value <= WORD_MASK
+** Post-Conditions: Asm instructions for the operation have been written
+*******************************************************************************/
+static void write_constant_operation(char binary_operator, unsigned value) {
+    bool is_increment = binary_operator == '+' && value == 1;
+    bool is_decrement = binary_operator == '+' && value == MINUS_ONE;
+    unsigned negated = -value & WORD_MASK;
+    if (tos_in_d && (is_increment || is_decrement)) {
+        write_asm("D=D%c1\n", is_increment ? '+' : '-');
+        return;
+    } else if (tos_in_d && value <= MAX_CONSTANT) {
+        write_asm(
+                "@%d\n"
+                "D=D%cA\n",
+                value, binary_operator
+        );
+        return;
+    } else if (tos_in_d && binary_operator == '+' && negated <= MAX_CONSTANT) {
+        write_asm(
+                "@%d\n"
+                "D=D-A\n",
+                negated
+        );
+        return;
+    }
+    spill_tos();
+    if (is_increment || is_decrement) {
+        write_asm(
+                "@SP\n"
+                "A=M-1\n"
+                "M=M%c1\n",
+                is_increment ? '+' : '-'
+        );
+        return;
+    }
+    write_load_constant(value);
+    write_asm(
+            "@SP\n"
+            "A=M-1\n"
+            "M=D%cM\n",
+            binary_operator
+    );
+}
+
 /*******************************************************************************
 ** Function: write_comparison
 ** Description: Writes compiled assembly code to perform a binary comparison
@@ -692,9 +2262,43 @@ static void write_binary_operation(const char binary_operator) {
 ** Post-Conditions: Asm instructions for relavant comparison have been written
 *******************************************************************************/
 static void write_comparison(const char *jump_code, int count) {
-    char *label = safe_malloc(MAX_OPERATOR_LEN * sizeof(char));
-    sprintf(label, "%s%d", jump_code, count);
-    fprintf(asm_file,
+    const char *label = make_label(jump_code, "", count, 0);
+    if (tos_in_d && !options.shared_comparisons) {
+        write_cached_comparison(jump_code, label);
+    } else if (options.shared_comparisons) {
+        spill_tos();
+        comparison *shared_comparison = get_comparison(jump_code);
+        count_mode = COUNT_INLINE;
+        write_inline_comparison(jump_code, label);
+        count_mode = COUNT_SHARED;
+        // the routine returns to the address passed in D
+        write_asm(
+                "@%s\n"
+                "D=A\n"
+                "@$%s\n"
+                "0;JMP\n"
+                "(%s)\n",
+                label, shared_comparison->name, label
+        );
+        count_mode = COUNT_ALL;
+        shared_comparison->used = true;
+    } else {
+        write_inline_comparison(jump_code, label);
+    }
+}
+
+/*******************************************************************************
+** Function: write_inline_comparison
+** Description: Writes a comparison that replaces the top two stack values with
+**     -1 if the jump condition holds for their difference, or 0 if not
+** Parameters:
+**     - jump_code: Jump directive if comarison is a success (JEQ, JLT, or JGT)
+**     - label: Unique label to jump to on success
+** Pre-Conditions: jump_code and label are non-null
+** Post-Conditions: Asm instructions for relavant comparison have been written
+*******************************************************************************/
+static void write_inline_comparison(const char *jump_code, const char *label) {
+    write_asm(
             POP_D
             "A=A-1\n"
             "D=M-D\n"
@@ -707,7 +2311,105 @@ static void write_comparison(const char *jump_code, int count) {
             "(%s)\n",
             label, jump_code, label
     );
-    free(label);
+}
+
+/*******************************************************************************
+** Function: write_cached_comparison
+** Description: Writes a comparison of the value below the top of the stack with
+**     the top value held in D, leaving -1 or 0 in D
+** Parameters:
+**     - jump_code: Jump directive if comarison is a success (JEQ, JLT, or JGT)
+**     - label: Unique label to jump to on success
+** Pre-Conditions: jump_code and label are non-null, tos_in_d is true
+** Post-Conditions: Asm instructions for relavant comparison have been written
+*******************************************************************************/
+static void write_cached_comparison(const char *jump_code, const char *label) {
+    write_asm(
+            "@SP\n"
+            "AM=M-1\n"
+            "D=M-D\n"
+            "@%s\n"
+            "D;%s\n"
+            "D=0\n"
+            "@%s.end\n"
+            "0;JMP\n"
+            "(%s)\n"
+            "D=-1\n"
+            "(%s.end)\n",
+            label, jump_code, label, label, label
+    );
+}
+
+/*******************************************************************************
+** Function: write_branch
+** Description: Writes a comparison followed by an if-goto as one jump on the
+**     difference of the top two stack values, without building the -1/0
+**     result. A not between them inverts the jump condition.
+** Parameters:
+**     - branch_comparison: Comparison operator feeding the if-goto
+**     - negated: Whether a not came between the comparison and the if-goto
+**     - label: Label to jump to
+** Pre-Conditions: branch_comparison and label are non-null
+** Post-Conditions: Branch asm instructions have been written
+*******************************************************************************/
+static void write_branch(const comparison *branch_comparison, bool negated,
+        const char *label) {
+    if (tos_in_d) {
+        write_asm(
+                "@SP\n"
+                "AM=M-1\n"
+                "D=M-D\n"
+        );
+        tos_in_d = false;
+    } else {
+        write_asm(
+                POP_D
+                "@SP\n"
+                "AM=M-1\n"
+                "D=M-D\n"
+        );
+    }
+    write_asm(
+            "@%s\n"
+            "D;%s\n",
+            label, negated ? branch_comparison->inverse_jump_code
+                    : branch_comparison->jump_code
+    );
+}
+
+/*******************************************************************************
+** Function: find_comparison
+** Description: Returns the comparison operator for a vm operator
+** Parameters:
+**     - operator: vm operator to look up
+** Pre-Conditions: N/A
+** Post-Conditions: Return value is NULL if the operator is not eq, lt or gt
+*******************************************************************************/
+static comparison *find_comparison(vm_operator operator) {
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        if (comparisons[i].operator == operator) {
+            return comparisons + i;
+        }
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+** Function: get_comparison
+** Description: Returns the comparison operator with the given jump directive
+** Parameters:
+**     - jump_code: Jump directive of the comparison (JEQ, JLT, or JGT)
+** Pre-Conditions: jump_code is non-null
+** Post-Conditions: Return value is non-null
+*******************************************************************************/
+static comparison *get_comparison(const char *jump_code) {
+    for (int i = 0; i < NUM_COMPARISONS; i++) {
+        if (strcmp(jump_code, comparisons[i].jump_code) == EXIT_SUCCESS) {
+            return comparisons + i;
+        }
+    }
+    fprintf(stderr, "Error: invalid comparison \"%s\"\n", jump_code);
+    exit(EXIT_FAILURE);
 }
 
 /*******************************************************************************
@@ -717,23 +2419,60 @@ static void write_comparison(const char *jump_code, int count) {
 ** Parameters:
 **     - function_name: Name of calling function
 ** Pre-Conditions: function_name is non-null
-** Post-Conditions: Return value is allocated memory and non-null
-*******************************************************************************/
-static char *get_return_label(const char *function_name) {
-    unsigned call_count;
-    if (hash_table_contains(call_counts, function_name)) {
-        call_count = hash_table_get(call_counts, function_name);
-        ++call_count;
-        hash_table_set(call_counts, function_name, call_count);
-    } else {
-        call_count = 0;
-        hash_table_add(call_counts, function_name, call_count);
-    }
-    size_t return_label_len = (strlen(function_name) + 5 /* strlen("$ret.") */
-            + CALL_COUNT_LEN) * sizeof(char);
-    char *return_label = safe_malloc(return_label_len);
-    sprintf(return_label, "%s$ret.%0*d", function_name, CALL_COUNT_LEN,
-            call_count);
-    return return_label;
+** Post-Conditions: Return value is non-null and valid until the next label is
+**     made
+*******************************************************************************/
+static const char *get_return_label(const char *function_name) {
+    unsigned call_count = (*hash_table_find_or_insert(call_counts,
+            function_name, 0))++;
+    return make_label(function_name, "$ret.", call_count, CALL_COUNT_LEN);
+}
+
+/*******************************************************************************
+** Function: hash_bytes
+** Description: Continues a 64-bit FNV-1a hash over len bytes
+** Parameters:
+**     - hash: Hash of the bytes before these, or FNV_OFFSET_BASIS
+**     - bytes: Bytes to hash
+**     - len: Number of bytes to hash
+** Pre-Conditions: bytes is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static unsigned long long hash_bytes(unsigned long long hash,
+        const void *bytes, size_t len) {
+    const unsigned char *byte = bytes;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ byte[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/*******************************************************************************
+** Function: make_label
+** Description: Builds a label from the fragment's label prefix, a name, a
+**     suffix and a zero-padded count in the label arena. The arena is emptied
+**     first, so it never holds more than the longest label and no memory is
+**     allocated per label.
+** Parameters:
+**     - name: Start of the label
+**     - suffix: Text between name and count
+**     - count: Number that makes the label unique
+**     - min_digits: Number of digits to zero-pad count to
+** Pre-Conditions: name and suffix are non-null
+** Post-Conditions: Return value is non-null and valid until the next label is
+**     made
+*******************************************************************************/
+static const char *make_label(const char *name, const char *suffix,
+        int count, int min_digits) {
+    arena_clear(labels);
+    if (label_prefix[0] != '\0') {
+        arena_append_string(labels, label_prefix);
+        arena_append_char(labels, '$');
+    }
+    arena_append_string(labels, name);
+    arena_append_string(labels, suffix);
+    arena_append_int(labels, count, min_digits);
+    arena_append_char(labels, '\0');
+    return labels->data;
 }
 
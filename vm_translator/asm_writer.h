@@ -1,9 +1,72 @@
 #ifndef ASM_WRITER_H
 #define ASM_WRITER_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "arena.h"
+#include "parser.h"
+#include "program.h"
+
+#define NUM_COMPARISONS 3
+// local, argument, this and that, the segments addressed through a pointer
+#define NUM_POINTER_SEGMENTS (SEG_THAT + 1)
+// offsets 0 to 7 are counted apart, larger ones together
+#define NUM_OFFSET_BUCKETS 9
+
+// code generation options, all off by default
+typedef struct {
+    bool shared_calls;        // call and return through one shared routine each
+    bool shared_comparisons;  // one shared routine each for eq, lt and gt
+    bool cache_tos;           // keep the top of the stack in D within blocks
+    bool fuse_moves;          // write push/pop pairs as direct moves
+    bool fuse_branches;       // write eq/lt/gt [not] if-goto as one jump
+    bool remove_dead_functions;  // leave out functions Sys.init cannot reach
+    bool static_frames;       // fixed frames for functions that cannot recurse
+    unsigned max_inline_commands;  // inline static-frame functions this small
+    bool fold_constants;      // fold constant arithmetic within functions
+} writer_options;
+
+// accesses to pointer segments by segment and offset, and the ROM words that
+// reaching small offsets by stepping from the pointer saved
+typedef struct {
+    unsigned accesses[NUM_POINTER_SEGMENTS][NUM_OFFSET_BUCKETS];
+    unsigned saved_words[NUM_POINTER_SEGMENTS][NUM_OFFSET_BUCKETS];
+} offset_histogram;
+
+// translated code of one part of the program, written independently of the
+// other parts and linked into the assembly file afterwards
+typedef struct {
+    arena *asm_code;
+    unsigned rom_words;
+    unsigned inline_rom_words;
+    unsigned discarded_rom_words;
+    unsigned fused_moves;
+    unsigned folded_commands;
+    offset_histogram offsets;
+    bool uses_shared_call;    // jumps to the shared call routine
+    bool uses_shared_return;  // jumps to the shared return routine
+    bool uses_comparison[NUM_COMPARISONS];  // jumps to eq, lt, gt routines
+} asm_fragment;
+
 void write_asm_instructions(const char *vm_line);
-void writer_init(const char *asm_file_path);
+void writer_init(const char *asm_file_path, writer_options writer_options);
 void writer_dispose();
+void writer_begin_fragment(const char *prefix);
+void writer_end_fragment(asm_fragment *fragment);
+void writer_link_fragment(asm_fragment *fragment);
+unsigned long long writer_fragment_key(const char *vm_code, size_t vm_code_len,
+        const char *vm_file_name);
+void writer_save_fragment(const asm_fragment *fragment, FILE *file);
+bool writer_load_fragment(asm_fragment *fragment, FILE *file);
+unsigned writer_rom_words();
+unsigned writer_inline_rom_words();
+unsigned writer_fused_moves();
+unsigned writer_folded_commands();
+const offset_histogram *writer_offset_histogram();
+void writer_set_discard(bool discard);
+unsigned writer_discarded_rom_words();
+void writer_use_static_frames(const vm_program *program, unsigned frames_end);
 void write_bootstrap();
 void set_current_vm_file_name(const char *vm_file_name);
 
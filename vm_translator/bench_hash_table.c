@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_input.h"
+#include "error_check.h"
+#include "hash_table.h"
+#include "linked_list.h"
+#include "parser.h"
+
+#define NUM_RUNS 20
+#define CALL_COUNT_TABLE_SIZE 100
+#define FUNCTION_TABLE_SIZE 1024
+#define HASH_MULTIPLIER_1 31
+#define HASH_MULTIPLIER_2 17
+
+// Times hash_table against the chained table it replaced, on the lookups the
+// translator makes for a set of .vm files:
+//   - call count update: one table per file, and for each call the count of
+//     the calling function is read and incremented, as in get_return_label
+//   - function index op: every function name is inserted into one table if
+//     it is not there yet, then looked up again, as in program.c
+//   bench_hash_table path/to/file.vm|path/to/dir ...
+
+// the chained table, kept here as the reference: an array of linked_list
+// buckets holding one malloced pair and one strdup per key
+typedef struct {
+    char *key;
+    unsigned value;
+} chained_pair;
+
+typedef struct {
+    linked_list **pair_lists;
+    unsigned size;
+} chained_table;
+
+// names the workloads use, taken from the input before timing starts
+typedef struct {
+    const char **callers;     // calling function of each call
+    unsigned *file_calls;     // index of each file's first call, then the end
+    const char **functions;   // name of each function command
+    unsigned num_calls;
+    unsigned num_functions;
+    unsigned num_files;
+} workload;
+
+static workload build_workload(const bench_input *input,
+        vm_instruction *instructions);
+static double time_call_counts(const workload *work, bool chained,
+        unsigned *checksum);
+static double time_function_indices(const workload *work, bool chained,
+        unsigned *checksum);
+static chained_table *chained_init(unsigned size);
+static unsigned chained_hash(const char *key, unsigned table_size);
+static chained_pair *chained_lookup(const chained_table *table,
+        const char *key);
+static bool chained_pair_has_key(const void *pair, const void *key);
+static void chained_add(chained_table *table, const char *key,
+        unsigned value);
+static void chained_dispose(chained_table *table);
+
+/*******************************************************************************
+** Function: main
+** Description: Prints the time per operation of each workload on each table,
+**     averaged over NUM_RUNS passes
+** Parameters:
+**     - argc: number of provided command-line arguments
+**     - argv: paths to .vm files and directories of them
+** Pre-Conditions: N/A
+** Post-Conditions: N/A
+*******************************************************************************/
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench_hash_table path/to/file.vm|path/to/dir "
+                "...\n");
+        return EXIT_FAILURE;
+    }
+    bench_input input = read_bench_input(argc - 1, argv + 1);
+    vm_instruction *instructions = safe_malloc(input.num_lines
+            * sizeof(vm_instruction));
+    workload work = build_workload(&input, instructions);
+    unsigned old_checksum;
+    unsigned new_checksum;
+    printf("%u calls and %u functions in %u files, %d runs\n",
+            work.num_calls, work.num_functions, work.num_files, NUM_RUNS);
+    double old_time = time_call_counts(&work, true, &old_checksum);
+    double new_time = time_call_counts(&work, false, &new_checksum);
+    printf("  call count update  old %6.1f ns  new %6.1f ns%s\n", old_time,
+            new_time, old_checksum == new_checksum ? "" : "  (disagree)");
+    old_time = time_function_indices(&work, true, &old_checksum);
+    new_time = time_function_indices(&work, false, &new_checksum);
+    printf("  function index op  old %6.1f ns  new %6.1f ns%s\n", old_time,
+            new_time, old_checksum == new_checksum ? "" : "  (disagree)");
+    free(work.callers);
+    free(work.file_calls);
+    free(work.functions);
+    free(instructions);
+    dispose_bench_input(&input);
+    return EXIT_SUCCESS;
+}
+
+/*******************************************************************************
+** Function: build_workload
+** Description: Parses the input and collects the calling function of every
+**     call and the name of every function
+** Parameters:
+**     - input: Lines of vm code
+**     - instructions: Room for one parsed instruction per line, which the
+**         names in the return value point into
+** Pre-Conditions: input and instructions are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static workload build_workload(const bench_input *input,
+        vm_instruction *instructions) {
+    workload work = {0};
+    work.num_files = input->num_files;
+    work.callers = safe_malloc(input->num_lines * sizeof(const char *));
+    work.functions = safe_malloc(input->num_lines * sizeof(const char *));
+    work.file_calls = safe_malloc((input->num_files + 1) * sizeof(unsigned));
+    for (unsigned file = 0; file < input->num_files; file++) {
+        work.file_calls[file] = work.num_calls;
+        const char *caller = "";
+        for (unsigned i = input->file_starts[file];
+                i < input->file_starts[file + 1]; i++) {
+            parse_vm_line(input->lines[i], &instructions[i]);
+            if (instructions[i].operator == OP_FUNCTION) {
+                caller = instructions[i].operand;
+                work.functions[work.num_functions++] = caller;
+            } else if (instructions[i].operator == OP_CALL) {
+                work.callers[work.num_calls++] = caller;
+            }
+        }
+    }
+    work.file_calls[input->num_files] = work.num_calls;
+    return work;
+}
+
+/*******************************************************************************
+** Function: time_call_counts
+** Description: Returns the time per call of keeping call counts, in
+**     nanoseconds
+** Parameters:
+**     - work: Calls to count
+**     - chained: true to time the chained table, false for hash_table
+**     - checksum: Set to a checksum of the counts
+** Pre-Conditions: work and checksum are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static double time_call_counts(const workload *work, bool chained,
+        unsigned *checksum) {
+    *checksum = 0;
+    double start = bench_seconds();
+    for (int run = 0; run < NUM_RUNS; run++) {
+        for (unsigned file = 0; file < work->num_files; file++) {
+            chained_table *old_table = NULL;
+            hash_table *new_table = NULL;
+            if (chained) {
+                old_table = chained_init(CALL_COUNT_TABLE_SIZE);
+            } else {
+                new_table = hash_table_init(CALL_COUNT_TABLE_SIZE);
+            }
+            for (unsigned i = work->file_calls[file];
+                    i < work->file_calls[file + 1]; i++) {
+                unsigned call_count;
+                if (!chained) {
+                    call_count = (*hash_table_find_or_insert(new_table,
+                            work->callers[i], 0))++;
+                } else if (chained_lookup(old_table, work->callers[i])
+                        != NULL) {
+                    // contains, get and set, one lookup each
+                    call_count = chained_lookup(old_table,
+                            work->callers[i])->value + 1;
+                    chained_lookup(old_table, work->callers[i])->value
+                            = call_count;
+                } else {
+                    call_count = 0;
+                    chained_add(old_table, work->callers[i], call_count);
+                }
+                *checksum = *checksum * 31 + call_count;
+            }
+            if (chained) {
+                chained_dispose(old_table);
+            } else {
+                hash_table_dispose(new_table);
+            }
+        }
+    }
+    double elapsed = bench_seconds() - start;
+    return elapsed * 1e9 / ((double) NUM_RUNS * work->num_calls);
+}
+
+/*******************************************************************************
+** Function: time_function_indices
+** Description: Returns the time per operation of inserting every function
+**     name into one table and looking each up again, in nanoseconds
+** Parameters:
+**     - work: Function names
+**     - chained: true to time the chained table, false for hash_table
+**     - checksum: Set to a checksum of the looked up indices
+** Pre-Conditions: work and checksum are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static double time_function_indices(const workload *work, bool chained,
+        unsigned *checksum) {
+    *checksum = 0;
+    double start = bench_seconds();
+    for (int run = 0; run < NUM_RUNS; run++) {
+        if (chained) {
+            chained_table *table = chained_init(FUNCTION_TABLE_SIZE);
+            for (unsigned i = 0; i < work->num_functions; i++) {
+                if (chained_lookup(table, work->functions[i]) == NULL) {
+                    chained_add(table, work->functions[i], i);
+                }
+            }
+            for (unsigned i = 0; i < work->num_functions; i++) {
+                // contains, then get
+                if (chained_lookup(table, work->functions[i]) != NULL) {
+                    *checksum = *checksum * 31
+                            + chained_lookup(table, work->functions[i])->value;
+                }
+            }
+            chained_dispose(table);
+        } else {
+            hash_table *table = hash_table_init(FUNCTION_TABLE_SIZE);
+            for (unsigned i = 0; i < work->num_functions; i++) {
+                hash_table_find_or_insert(table, work->functions[i], i);
+            }
+            for (unsigned i = 0; i < work->num_functions; i++) {
+                const unsigned *index = hash_table_find(table,
+                        work->functions[i]);
+                if (index != NULL) {
+                    *checksum = *checksum * 31 + *index;
+                }
+            }
+            hash_table_dispose(table);
+        }
+    }
+    double elapsed = bench_seconds() - start;
+    return elapsed * 1e9 / ((double) NUM_RUNS * 2 * work->num_functions);
+}
+
+/*******************************************************************************
+** Function: chained_init
+** Description: Returns an empty chained table with size buckets
+** Parameters:
+**     - size: Number of buckets
+** Pre-Conditions: size > 0
+** Post-Conditions: Return value is non-null
+*******************************************************************************/
+static chained_table *chained_init(unsigned size) {
+    chained_table *table = safe_malloc(sizeof(chained_table));
+    table->size = size;
+    table->pair_lists = safe_malloc(size * sizeof(linked_list *));
+    for (unsigned i = 0; i < size; i++) {
+        table->pair_lists[i] = NULL;
+    }
+    return table;
+}
+
+/*******************************************************************************
+** Function: chained_hash
+** Description: Returns the bucket of key, with the chained table's hash
+** Parameters:
+**     - key: String to hash
+**     - table_size: Number of buckets
+** Pre-Conditions: key is non-null
+** Post-Conditions: Return value < table_size
+*******************************************************************************/
+static unsigned chained_hash(const char *key, unsigned table_size) {
+    unsigned hash_value;
+    for (hash_value = 0; *key != '\0'; key++) {
+        hash_value = *key * HASH_MULTIPLIER_1 + hash_value * HASH_MULTIPLIER_2;
+    }
+    return hash_value % table_size;
+}
+
+/*******************************************************************************
+** Function: chained_lookup
+** Description: Returns the pair holding key, or NULL if key is not in table
+** Parameters:
+**     - table: Table to search
+**     - key: Key to search for
+** Pre-Conditions: table and key are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static chained_pair *chained_lookup(const chained_table *table,
+        const char *key) {
+    const linked_list *pair_list
+            = table->pair_lists[chained_hash(key, table->size)];
+    if (pair_list == NULL) {
+        return NULL;
+    }
+    return list_search(pair_list, key, &chained_pair_has_key);
+}
+
+/*******************************************************************************
+** Function: chained_pair_has_key
+** Description: Returns true if the key of pair is key
+** Parameters:
+**     - pair: chained_pair to check
+**     - key: Key to compare with
+** Pre-Conditions: pair and key are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static bool chained_pair_has_key(const void *pair, const void *key) {
+    return strcmp(((const chained_pair *) pair)->key, key) == EXIT_SUCCESS;
+}
+
+/*******************************************************************************
+** Function: chained_add
+** Description: Adds key to table, as the chained table did after checking
+**     that key was not there yet
+** Parameters:
+**     - table: Table to add to
+**     - key: Key to add
+**     - value: Value of key
+** Pre-Conditions: table and key are non-null, key is not in table
+** Post-Conditions: N/A
+*******************************************************************************/
+static void chained_add(chained_table *table, const char *key,
+        unsigned value) {
+    assert_condition(chained_lookup(table, key) == NULL,
+            "Error: Key already exists in hash table, cannot add it again\n");
+    chained_pair *pair = safe_malloc(sizeof(chained_pair));
+    pair->key = safe_strdup(key);
+    pair->value = value;
+    linked_list **pair_list = &table->pair_lists[chained_hash(key,
+            table->size)];
+    if (*pair_list == NULL) {
+        *pair_list = new_linked_list();
+    }
+    list_append(*pair_list, pair);
+}
+
+/*******************************************************************************
+** Function: chained_dispose
+** Description: Frees every pair, key, list node and list of table, and the
+**     table itself
+** Parameters:
+**     - table: Table to free
+** Pre-Conditions: table is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static void chained_dispose(chained_table *table) {
+    for (unsigned i = 0; i < table->size; i++) {
+        linked_list *pair_list = table->pair_lists[i];
+        if (pair_list == NULL) {
+            continue;
+        }
+        list_node *node = pair_list->head;
+        while (node != NULL) {
+            chained_pair *pair = node->data;
+            free(pair->key);
+            free(pair);
+            list_node *next = node->next;
+            free(node);
+            node = next;
+        }
+        free(pair_list);
+    }
+    free(table->pair_lists);
+    free(table);
+}
@@ -0,0 +1,154 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "bench_input.h"
+#include "error_check.h"
+#include "parser.h"
+
+#define VM_EXTENSION ".vm"
+#define MIN_CAPACITY 1024
+
+static void read_path(bench_input *input, const char *path,
+        unsigned *lines_capacity, unsigned *files_capacity);
+static void read_vm_file(bench_input *input, const char *vm_file_path,
+        unsigned *lines_capacity, unsigned *files_capacity);
+static void *grow(void *array, unsigned *capacity, size_t element_size);
+
+/*******************************************************************************
+** Function: read_bench_input
+** Description: Reads every line of vm code in the given .vm files and in the
+**     .vm files directly inside the given directories
+** Parameters:
+**     - num_paths: Number of paths
+**     - paths: Paths to .vm files and directories
+** Pre-Conditions: paths holds num_paths non-null paths
+** Post-Conditions: Exits with an error if a path cannot be read or no lines
+**     are found
+*******************************************************************************/
+bench_input read_bench_input(int num_paths, char **paths) {
+    bench_input input = {0};
+    unsigned lines_capacity = 0;
+    unsigned files_capacity = 0;
+    for (int i = 0; i < num_paths; i++) {
+        read_path(&input, paths[i], &lines_capacity, &files_capacity);
+    }
+    assert_condition(input.num_lines > 0, "Error: no vm code found\n");
+    input.file_starts = grow(input.file_starts, &files_capacity,
+            sizeof(unsigned));
+    input.file_starts[input.num_files] = input.num_lines;
+    return input;
+}
+
+/*******************************************************************************
+** Function: read_path
+** Description: Reads the lines of one .vm file, or of each .vm file in a
+**     directory
+** Parameters:
+**     - input: Input to append lines to
+**     - path: Path to a .vm file or a directory
+**     - lines_capacity: Number of lines input->lines has room for
+**     - files_capacity: Number of entries input->file_starts has room for
+** Pre-Conditions: All parameters are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static void read_path(bench_input *input, const char *path,
+        unsigned *lines_capacity, unsigned *files_capacity) {
+    struct stat path_stat;
+    assert_condition(stat(path, &path_stat) == 0,
+            "Error: cannot read `%s'\n", path);
+    if (!S_ISDIR(path_stat.st_mode)) {
+        read_vm_file(input, path, lines_capacity, files_capacity);
+        return;
+    }
+    DIR *dir = safe_opendir(path);
+    struct dirent *dir_entry;
+    while ((dir_entry = readdir(dir)) != NULL) {
+        const char *extension = strrchr(dir_entry->d_name, '.');
+        if (extension == NULL || strcmp(extension, VM_EXTENSION) != 0) {
+            continue;
+        }
+        char *file_path = safe_malloc(strlen(path) + strlen(dir_entry->d_name)
+                + 2);
+        sprintf(file_path, "%s/%s", path, dir_entry->d_name);
+        read_vm_file(input, file_path, lines_capacity, files_capacity);
+        free(file_path);
+    }
+    safe_closedir(dir);
+}
+
+/*******************************************************************************
+** Function: read_vm_file
+** Description: Appends the lines of one .vm file to input
+** Parameters:
+**     - input: Input to append lines to
+**     - vm_file_path: Path to the .vm file
+**     - lines_capacity: Number of lines input->lines has room for
+**     - files_capacity: Number of entries input->file_starts has room for
+** Pre-Conditions: All parameters are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static void read_vm_file(bench_input *input, const char *vm_file_path,
+        unsigned *lines_capacity, unsigned *files_capacity) {
+    FILE *vm_file = safe_fopen(vm_file_path, "r");
+    if (input->num_files == *files_capacity) {
+        input->file_starts = grow(input->file_starts, files_capacity,
+                sizeof(unsigned));
+    }
+    input->file_starts[input->num_files++] = input->num_lines;
+    char vm_line[BENCH_LINE_LEN];
+    while (get_line(vm_line, BENCH_LINE_LEN, vm_file) != NULL) {
+        if (input->num_lines == *lines_capacity) {
+            input->lines = grow(input->lines, lines_capacity,
+                    sizeof(input->lines[0]));
+        }
+        strcpy(input->lines[input->num_lines++], vm_line);
+    }
+    safe_fclose(vm_file);
+}
+
+/*******************************************************************************
+** Function: grow
+** Description: Doubles the capacity of an array
+** Parameters:
+**     - array: Array to grow, or NULL
+**     - capacity: Number of elements array has room for
+**     - element_size: Size of one element
+** Pre-Conditions: capacity is non-null
+** Post-Conditions: Return value is non-null
+*******************************************************************************/
+static void *grow(void *array, unsigned *capacity, size_t element_size) {
+    *capacity = *capacity ? *capacity * 2 : MIN_CAPACITY;
+    array = realloc(array, *capacity * element_size);
+    assert_nonnull(array, "Error allocating memory");
+    return array;
+}
+
+/*******************************************************************************
+** Function: dispose_bench_input
+** Description: Frees memory allocated to the lines of input
+** Parameters:
+**     - input: Input to free
+** Pre-Conditions: input is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+void dispose_bench_input(bench_input *input) {
+    free(input->lines);
+    free(input->file_starts);
+}
+
+/*******************************************************************************
+** Function: bench_seconds
+** Description: Returns the time of a monotonic clock in seconds
+** Parameters: void
+** Pre-Conditions: N/A
+** Post-Conditions: N/A
+*******************************************************************************/
+double bench_seconds() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
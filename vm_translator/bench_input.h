@@ -0,0 +1,19 @@
+#ifndef BENCH_INPUT_H
+#define BENCH_INPUT_H
+
+#define BENCH_LINE_LEN 80
+
+// the lines of vm code a benchmark runs over, held in memory so that reading
+// files is not timed
+typedef struct {
+    char (*lines)[BENCH_LINE_LEN];  // without comments and newlines
+    unsigned num_lines;
+    unsigned *file_starts;  // index of each file's first line, then num_lines
+    unsigned num_files;
+} bench_input;
+
+bench_input read_bench_input(int num_paths, char **paths);
+void dispose_bench_input(bench_input *input);
+double bench_seconds();
+
+#endif
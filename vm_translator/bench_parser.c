@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench_input.h"
+#include "parser.h"
+
+#define NUM_RUNS 20
+#define MAX_NAME_LEN 16
+
+// Times decoding lines of vm code, in memory, with parse_vm_line and with the
+// sscanf and strcmp decoding it replaced:
+//   bench_parser path/to/file.vm|path/to/dir ...
+
+static const char *const reference_operator_names[NUM_VM_OPERATORS] = {
+    "push", "pop", "add", "sub", "neg", "eq", "lt", "gt", "and", "or", "not",
+    "label", "goto", "if-goto", "call", "function", "return"
+};
+
+static const char *const reference_segment_names[NUM_SEGMENTS] = {
+    "local", "argument", "this", "that", "constant", "static", "temp",
+    "pointer"
+};
+
+static unsigned decode_with_sscanf(const char *vm_line);
+static unsigned decode_with_parser(const char *vm_line);
+static double time_decoder(const bench_input *input,
+        unsigned (*decode) (const char *), unsigned *checksum);
+
+/*******************************************************************************
+** Function: main
+** Description: Prints the time each decoder takes per line, averaged over
+**     NUM_RUNS passes over the input
+** Parameters:
+**     - argc: number of provided command-line arguments
+**     - argv: paths to .vm files and directories of them
+** Pre-Conditions: N/A
+** Post-Conditions: N/A
+*******************************************************************************/
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: bench_parser path/to/file.vm|path/to/dir "
+                "...\n");
+        return EXIT_FAILURE;
+    }
+    bench_input input = read_bench_input(argc - 1, argv + 1);
+    unsigned sscanf_checksum;
+    unsigned parser_checksum;
+    double sscanf_time = time_decoder(&input, decode_with_sscanf,
+            &sscanf_checksum);
+    double parser_time = time_decoder(&input, decode_with_parser,
+            &parser_checksum);
+    printf("%u lines in %u files, %d runs\n", input.num_lines,
+            input.num_files, NUM_RUNS);
+    printf("  sscanf + strcmp %6.1f ns/line\n", sscanf_time);
+    printf("  parse_vm_line   %6.1f ns/line (%.1fx)\n", parser_time,
+            sscanf_time / parser_time);
+    if (sscanf_checksum != parser_checksum) {
+        printf("  decoders disagree: checksums %08x and %08x\n",
+                sscanf_checksum, parser_checksum);
+    }
+    dispose_bench_input(&input);
+    return EXIT_SUCCESS;
+}
+
+/*******************************************************************************
+** Function: time_decoder
+** Description: Returns the time decode takes per line, in nanoseconds
+** Parameters:
+**     - input: Lines to decode
+**     - decode: Decoder, which returns a checksum of what it decoded
+**     - checksum: Set to the combined checksum of every decoded line, which
+**         also keeps the compiler from dropping the work
+** Pre-Conditions: All parameters are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static double time_decoder(const bench_input *input,
+        unsigned (*decode) (const char *), unsigned *checksum) {
+    *checksum = 0;
+    double start = bench_seconds();
+    for (int run = 0; run < NUM_RUNS; run++) {
+        for (unsigned i = 0; i < input->num_lines; i++) {
+            *checksum = *checksum * 31 + decode(input->lines[i]);
+        }
+    }
+    double elapsed = bench_seconds() - start;
+    return elapsed * 1e9 / ((double) NUM_RUNS * input->num_lines);
+}
+
+/*******************************************************************************
+** Function: decode_with_sscanf
+** Description: Decodes a line the way the translator did before
+**     parse_vm_line: sscanf into strings, then strcmp against each operator
+**     and segment name in turn
+** Parameters:
+**     - vm_line: Line to decode
+** Pre-Conditions: vm_line is non-null
+** Post-Conditions: Return value is a checksum of the operator, segment and
+**     value
+*******************************************************************************/
+static unsigned decode_with_sscanf(const char *vm_line) {
+    char operator_name[MAX_NAME_LEN];
+    char operand[MAX_OPERAND_LEN];
+    unsigned value = 0;
+    int operator = 0;
+    int segment = SEG_NONE;
+    sscanf(vm_line, "%s %s %u", operator_name, operand, &value);
+    while (operator < NUM_VM_OPERATORS && strcmp(operator_name,
+            reference_operator_names[operator]) != EXIT_SUCCESS) {
+        operator++;
+    }
+    if (operator == OP_PUSH || operator == OP_POP) {
+        segment = 0;
+        while (segment < NUM_SEGMENTS && strcmp(operand,
+                reference_segment_names[segment]) != EXIT_SUCCESS) {
+            segment++;
+        }
+    } else if (operator < OP_LABEL || operator == OP_RETURN) {
+        value = 0;
+    }
+    return (operator * NUM_SEGMENTS + segment) * 65536 + value;
+}
+
+/*******************************************************************************
+** Function: decode_with_parser
+** Description: Decodes a line with parse_vm_line
+** Parameters:
+**     - vm_line: Line to decode
+** Pre-Conditions: vm_line is non-null
+** Post-Conditions: Return value is a checksum of the operator, segment and
+**     value
+*******************************************************************************/
+static unsigned decode_with_parser(const char *vm_line) {
+    vm_instruction instruction;
+    parse_vm_line(vm_line, &instruction);
+    return (instruction.operator * NUM_SEGMENTS + instruction.segment) * 65536
+            + instruction.value;
+}
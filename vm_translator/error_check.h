@@ -3,7 +3,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define DEBUG 1
+#ifndef DEBUG
+#   define DEBUG 1
+#endif
 
 #if DEBUG
 #   define print_failure_info() \
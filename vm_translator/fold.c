@@ -0,0 +1,251 @@
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "fold.h"
+
+static void fold_last_commands(vm_command *commands, unsigned *num_folded);
+static bool is_constant_push(const vm_command *command);
+static bool is_stack_operation(const vm_command *command);
+static bool is_binary_operator(vm_operator operator);
+static unsigned evaluate(vm_operator operator, unsigned x, unsigned y);
+static void set_constant_push(vm_command *command, unsigned value);
+static void set_constant_operation(vm_command *command, vm_operator operator,
+        unsigned value);
+
+// names of the operators that may take a constant operand, for comments
+static const char *const constant_operation_names[NUM_VM_OPERATORS] = {
+    [OP_ADD] = "add",
+    [OP_AND] = "and",
+    [OP_OR]  = "or"
+};
+
+/*******************************************************************************
+** Function: fold_constants
+** Description: Simplifies a run of vm commands in place:
+**     - arithmetic, logic and comparisons of constants are computed, with the
+**       16-bit wraparound of the Hack computer
+**     - adding, subtracting or or-ing 0 and and-ing -1 are removed, as are
+**       double negations and double nots
+**     - any other add, sub, and or or with a constant second operand becomes
+**       one command with a constant operand, which the writer can do in place
+**     Only adjacent commands are combined, so labels and jumps are never
+**     folded across.
+** Parameters:
+**     - commands: Commands to simplify
+**     - num_commands: Number of commands
+** Pre-Conditions: commands is non-null
+** Post-Conditions: Return value is the number of commands left at the start
+**     of commands
+*******************************************************************************/
+unsigned fold_constants(vm_command *commands, unsigned num_commands) {
+    unsigned num_folded = 0;
+    for (unsigned i = 0; i < num_commands; i++) {
+        commands[num_folded++] = commands[i];
+        fold_last_commands(commands, &num_folded);
+    }
+    return num_folded;
+}
+
+/*******************************************************************************
+** Function: signed_word
+** Description: Returns the value of a 16-bit word in two's complement
+** Parameters:
+**     - word: Word to convert
+** Pre-Conditions: word <= WORD_MASK
+** Post-Conditions: Return value is in [-32768, 32767]
+*******************************************************************************/
+int signed_word(unsigned word) {
+    return word > MAX_CONSTANT ? (int) word - (WORD_MASK + 1) : (int) word;
+}
+
+/*******************************************************************************
+** Function: fold_last_commands
+** Description: Simplifies the end of the folded commands after a command has
+**     been appended, for as long as a rule applies
+** Parameters:
+**     - commands: Folded commands
+**     - num_folded: Number of folded commands
+** Pre-Conditions: commands and num_folded are non-null, *num_folded > 0
+** Post-Conditions: No rule applies to the last commands
+*******************************************************************************/
+static void fold_last_commands(vm_command *commands, unsigned *num_folded) {
+    while (*num_folded >= 2) {
+        vm_command *last = &commands[*num_folded - 1];
+        vm_command *previous = &commands[*num_folded - 2];
+        vm_operator operator = last->args.operator;
+        if (!is_stack_operation(last)) {
+            return;
+        }
+        if (last->args.segment == SEG_CONSTANT) {
+            // an operation with a constant operand made by an earlier rule
+            // only takes one value from the stack
+            if (is_constant_push(previous)) {
+                set_constant_push(previous, evaluate(operator,
+                        previous->args.value, last->args.value));
+                *num_folded -= 1;
+            } else if (operator == OP_ADD && previous->args.operator == OP_ADD
+                    && previous->args.segment == SEG_CONSTANT) {
+                // two additions of constants in a row
+                unsigned value = (previous->args.value + last->args.value)
+                        & WORD_MASK;
+                if (value == 0) {
+                    *num_folded -= 2;
+                } else {
+                    set_constant_operation(previous, OP_ADD, value);
+                    *num_folded -= 1;
+                }
+            } else {
+                return;
+            }
+        } else if (is_binary_operator(operator) && *num_folded >= 3
+                && is_constant_push(previous)
+                && is_constant_push(&commands[*num_folded - 3])) {
+            // push constant x, push constant y, op
+            vm_command *first = &commands[*num_folded - 3];
+            set_constant_push(first, evaluate(operator, first->args.value,
+                    previous->args.value));
+            *num_folded -= 2;
+        } else if ((operator == OP_NEG || operator == OP_NOT)
+                && is_constant_push(previous)) {
+            set_constant_push(previous, evaluate(operator, 0,
+                    previous->args.value));
+            *num_folded -= 1;
+        } else if ((operator == OP_NEG || operator == OP_NOT)
+                && previous->args.operator == operator) {
+            *num_folded -= 2;
+        } else if ((operator == OP_ADD || operator == OP_SUB
+                || operator == OP_AND || operator == OP_OR)
+                && is_constant_push(previous)) {
+            unsigned value = previous->args.value;
+            if (operator == OP_SUB) {
+                // x - y = x + -y
+                operator = OP_ADD;
+                value = -value & WORD_MASK;
+            }
+            if ((operator != OP_AND && value == 0)
+                    || (operator == OP_AND && value == MINUS_ONE)) {
+                *num_folded -= 2;
+            } else {
+                set_constant_operation(previous, operator, value);
+                *num_folded -= 1;
+            }
+        } else {
+            return;
+        }
+    }
+}
+
+/*******************************************************************************
+** Function: is_constant_push
+** Description: Returns true if command pushes a constant
+** Parameters:
+**     - command: Command to check
+** Pre-Conditions: command is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static bool is_constant_push(const vm_command *command) {
+    return command->args.operator == OP_PUSH
+            && command->args.segment == SEG_CONSTANT;
+}
+
+/*******************************************************************************
+** Function: is_stack_operation
+** Description: Returns true if command is an arithmetic, logic or comparison
+**     command, with or without a constant operand
+** Parameters:
+**     - command: Command to check
+** Pre-Conditions: command is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static bool is_stack_operation(const vm_command *command) {
+    return command->args.operator >= OP_ADD
+            && command->args.operator <= OP_NOT;
+}
+
+/*******************************************************************************
+** Function: is_binary_operator
+** Description: Returns true if operator pops two values and pushes one
+** Parameters:
+**     - operator: Operator to check
+** Pre-Conditions: N/A
+** Post-Conditions: N/A
+*******************************************************************************/
+static bool is_binary_operator(vm_operator operator) {
+    return operator == OP_ADD || operator == OP_SUB || operator == OP_EQ
+            || operator == OP_LT || operator == OP_GT || operator == OP_AND
+            || operator == OP_OR;
+}
+
+/*******************************************************************************
+** Function: evaluate
+** Description: Returns the result of a stack operation on constants as the
+**     Hack computer would compute it. Comparisons look at the sign of x - y
+**     like the written code does, overflow included.
+** Parameters:
+**     - operator: Operator to apply
+**     - x: First operand, or 0 for neg and not
+**     - y: Second operand
+** Pre-Conditions: operator is a stack operator, x and y <= WORD_MASK
+** Post-Conditions: Return value <= WORD_MASK
+*******************************************************************************/
+static unsigned evaluate(vm_operator operator, unsigned x, unsigned y) {
+    int difference = signed_word((x - y) & WORD_MASK);
+    switch (operator) {
+        case OP_ADD:
+            return (x + y) & WORD_MASK;
+        case OP_SUB:
+            return (x - y) & WORD_MASK;
+        case OP_NEG:
+            return -y & WORD_MASK;
+        case OP_EQ:
+            return difference == 0 ? MINUS_ONE : 0;
+        case OP_LT:
+            return difference < 0 ? MINUS_ONE : 0;
+        case OP_GT:
+            return difference > 0 ? MINUS_ONE : 0;
+        case OP_AND:
+            return x & y;
+        case OP_OR:
+            return x | y;
+        case OP_NOT:
+            return ~y & WORD_MASK;
+        default:
+            return 0;
+    }
+}
+
+/*******************************************************************************
+** Function: set_constant_push
+** Description: Turns command into a push of a constant word
+** Parameters:
+**     - command: Command to overwrite
+**     - value: Word to push
+** Pre-Conditions: command is non-null, value <= WORD_MASK
+** Post-Conditions: N/A
+*******************************************************************************/
+static void set_constant_push(vm_command *command, unsigned value) {
+    command->args.operator = OP_PUSH;
+    command->args.segment = SEG_CONSTANT;
+    command->args.value = value;
+    snprintf(command->vm_line, VM_COMMAND_LINE_LEN,
+            "push constant %d (folded)", signed_word(value));
+}
+
+/*******************************************************************************
+** Function: set_constant_operation
+** Description: Turns command into an add, and or or with a constant operand
+** Parameters:
+**     - command: Command to overwrite
+**     - operator: OP_ADD, OP_AND or OP_OR
+**     - value: Constant second operand
+** Pre-Conditions: command is non-null, value <= WORD_MASK
+** Post-Conditions: N/A
+*******************************************************************************/
+static void set_constant_operation(vm_command *command, vm_operator operator,
+        unsigned value) {
+    command->args.operator = operator;
+    command->args.segment = SEG_CONSTANT;
+    command->args.value = value;
+    snprintf(command->vm_line, VM_COMMAND_LINE_LEN, "%s constant %d (folded)",
+            constant_operation_names[operator], signed_word(value));
+}
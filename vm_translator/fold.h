@@ -0,0 +1,24 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "parser.h"
+
+#define VM_COMMAND_LINE_LEN 80
+// constants are 16-bit words; folded ones may be any word, not just 0..32767
+#define WORD_MASK 0xFFFF
+#define MAX_CONSTANT 32767
+#define MINUS_ONE WORD_MASK
+
+// one parsed vm command and the line it came from, for the comment. Folding
+// may produce push constant with any word as its value, and add, and or or
+// with segment SEG_CONSTANT, which take their second operand from value
+// rather than from the stack.
+typedef struct {
+    vm_instruction args;
+    char vm_line[VM_COMMAND_LINE_LEN];
+} vm_command;
+
+unsigned fold_constants(vm_command *commands, unsigned num_commands);
+int signed_word(unsigned word);
+
+#endif
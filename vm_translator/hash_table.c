@@ -3,9 +3,12 @@
 ** Author: Quinn Yockey
 ** Date: November 2023
 ** Description: A collection of basic functions to manipulate hash tables with
-**     string-int key-value pairs.
+**     string-int key-value pairs. Collisions are resolved by linear probing
+**     within one array of slots, and keys are copied into an arena, so adding
+**     a key allocates nothing until the table or the arena has to grow.
 *******************************************************************************/
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,164 +16,185 @@
 #include "error_check.h"
 #include "hash_table.h"
 
-#define HASH_MULTIPLIER_1 31
-#define HASH_MULTIPLIER_2 17
-#define KEY_VALUE_PAIR_MAX_STR_LEN 128
+#define EMPTY_SLOT UINT_MAX
+#define MIN_CAPACITY 8
+#define KEY_ARENA_LEN 256
+// the table grows once more than 3/4 of its slots are used
+#define MAX_LOAD_NUMERATOR 3
+#define MAX_LOAD_DENOMINATOR 4
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
 
-static unsigned hash(const char *key, unsigned table_size);
-static key_value_pair *lookup(const hash_table *table, const char *key);
-static const char *key_value_pair_to_string(const void *pair);
-static bool key_value_pair_has_key(const void *pair, const void *key);
+static unsigned hash(const char *key);
+static hash_table_slot *probe(const hash_table *table, const char *key,
+        unsigned key_hash);
+static void grow(hash_table *table);
 
 /*******************************************************************************
 ** Function: hash_table_init
 ** Description: Allocates memory for a hash_table and returns a pointer to the
-**     table. The table contains an array of linked lists to prevent collisions.
+**     table. The table starts with enough slots for size keys and grows
+**     whenever it gets too full.
 ** Parameters:
-**     - size: Number of linked lists in array
+**     - size: Number of keys to make room for up front
 ** Pre-Conditions: N/A
-** Post-Conditions: Return value is a non-null pointer to an initialized hash
-**     table. Linked lists are not initialized.
+** Post-Conditions: Return value is a non-null pointer to an empty hash table
 *******************************************************************************/
 hash_table *hash_table_init(unsigned size) {
     hash_table *table = safe_malloc(sizeof(hash_table));
-    table->size = size;
-    table->pair_lists = safe_malloc(size * sizeof(linked_list **));
-    for (int list_id = 0; list_id < size; list_id++) {
-        table->pair_lists[list_id] = NULL;
+    table->capacity = MIN_CAPACITY;
+    while (table->capacity * MAX_LOAD_NUMERATOR
+            < size * MAX_LOAD_DENOMINATOR) {
+        table->capacity *= 2;
     }
+    table->slots = safe_malloc(table->capacity * sizeof(hash_table_slot));
+    for (unsigned i = 0; i < table->capacity; i++) {
+        table->slots[i].key_offset = EMPTY_SLOT;
+    }
+    table->num_keys = 0;
+    table->keys = arena_init(KEY_ARENA_LEN);
     return table;
 }
 
 /*******************************************************************************
 ** Function: hash
-** Description: Returns a hash value in the range [0, table_size) using the
-**     polynomial rolling hash algorithm. It's nowrhere near perfect or secure
-**     but it's quick and more than sufficient for this project
+** Description: Returns the 32-bit FNV-1a hash of key. Its low bits are mixed
+**     well enough to pick a slot in a table whose size is a power of two.
 ** Parameters:
 **     - key: String to hash
-**     - table_size: Upper bound for range of hash function
 ** Pre-Conditions: key is non-null
-** Post-Conditions: Return value is in range [0, table_size)
+** Post-Conditions: N/A
 *******************************************************************************/
-static unsigned hash(const char *key, unsigned table_size) {
-    assert_nonnull(key, "Error: Cannot hash a NULL string\n");
-    unsigned hash_value;
-    for (hash_value = 0; *key != '\0'; key++) {
-        hash_value = *key * HASH_MULTIPLIER_1 + hash_value * HASH_MULTIPLIER_2;
+static unsigned hash(const char *key) {
+    unsigned hash_value = FNV_OFFSET_BASIS;
+    for (; *key != '\0'; key++) {
+        hash_value = (hash_value ^ (unsigned char) *key) * FNV_PRIME;
     }
-    return hash_value % table_size;
+    return hash_value;
 }
 
 /*******************************************************************************
-** Function: lookup
-** Description: Returns a key_value_pair in table corresponding to key, or NULL
-**     if key is not contained within table.
+** Function: probe
+** Description: Returns the slot in table that holds key, or else the empty
+**     slot where key would be inserted. Slots are checked in order from the
+**     one key_hash selects, and strings are only compared once the stored
+**     hashes match.
 ** Parameters:
 **     - table: hash_table to search in
-**     - key: String to get key_value_pair for
-** Pre-Conditions: table and key are both non-null
-** Post-Conditions: N/A
+**     - key: Key to search for
+**     - key_hash: hash(key)
+** Pre-Conditions: table and key are both non-null, table has an empty slot
+** Post-Conditions: Return value is non-null
 *******************************************************************************/
-static key_value_pair *lookup(const hash_table *table, const char *key) {
-    assert_nonnull(table, "Error: Cannot lookup key in NULL table\n");
-    assert_nonnull(key, "Error: Cannot lookup NULL key in table\n");
-    unsigned hash_value = hash(key, table->size);
-    const linked_list *pair_list = table->pair_lists[hash_value];
-    if (!pair_list) {
-        // no keys with matching hash
-        return NULL;
+static hash_table_slot *probe(const hash_table *table, const char *key,
+        unsigned key_hash) {
+    unsigned mask = table->capacity - 1;
+    for (unsigned i = key_hash & mask; ; i = (i + 1) & mask) {
+        hash_table_slot *slot = &table->slots[i];
+        if (slot->key_offset == EMPTY_SLOT || (slot->key_hash == key_hash
+                && strcmp(table->keys->data + slot->key_offset, key)
+                == EXIT_SUCCESS)) {
+            return slot;
+        }
     }
-    return list_search(pair_list, key, &key_value_pair_has_key);
 }
 
 /*******************************************************************************
-** Function: hash_table_contains
-** Description: Returns whether or not table contains key
+** Function: hash_table_find
+** Description: Returns a pointer to the value mapped to key, or NULL if key is
+**     not in table
 ** Parameters:
-**     - table: hash_table to search in
-**     - key: String to search for
+**     - table: hash_table to search for key in
+**     - key: key to search for
 ** Pre-Conditions: table and key are both non-null
-** Post-Conditions: N/A
+** Post-Conditions: A non-null return value is valid until the next key is
+**     inserted
 *******************************************************************************/
-bool hash_table_contains(const hash_table *table, const char *key) {
-    return lookup(table, key) != NULL;
+unsigned *hash_table_find(const hash_table *table, const char *key) {
+    assert_nonnull(table, "Error: Cannot search NULL hash table\n");
+    assert_nonnull(key, "Error: Cannot search for NULL key in hash table\n");
+    hash_table_slot *slot = probe(table, key, hash(key));
+    if (slot->key_offset == EMPTY_SLOT) {
+        // key not found
+        return NULL;
+    }
+    return &slot->value;
 }
 
 /*******************************************************************************
-** Function: hash_table_add
-** Description: Add a key-value pair to table
+** Function: hash_table_find_or_insert
+** Description: Returns a pointer to the value mapped to key, first mapping key
+**     to value if key is not in table yet. Looking a key up and updating its
+**     value takes one hash and one probe sequence.
 ** Parameters:
-**     - table: hash_table to put key_value_pair in
-**     - key: key of key_value_pair
-**     - value: value of key_value_pair
+**     - table: hash_table to search for key in
+**     - key: key to search for
+**     - value: value to map key to if key is not in table
 ** Pre-Conditions: table and key are both non-null
-** Post-Conditions: A key_value_pair containing key and value was appended to
-**     the key-value pair linked list matching the hash value of key
+** Post-Conditions: Return value is non-null and valid until the next key is
+**     inserted
 *******************************************************************************/
-void hash_table_add(const hash_table *table, const char *key, unsigned value) {
+unsigned *hash_table_find_or_insert(hash_table *table, const char *key,
+        unsigned value) {
     assert_nonnull(table, "Error: Cannot add key-value pair to "
             "NULL hash table\n");
     assert_nonnull(key, "Error: Cannot add NULL key to key-value pair "
             "in hash table\n");
-    assert_condition(!hash_table_contains(table, key), "Error: Key already "
-            "exists in hash table, cannot add it again\n");
-    key_value_pair *new_pair = safe_malloc(sizeof(key_value_pair));
-    new_pair->key = safe_strdup(key);
-    new_pair->value = value;
-    unsigned hash_value = hash(key, table->size);
-    linked_list **pair_list = &table->pair_lists[hash_value];
-    if (!*pair_list) {
-        *pair_list = new_linked_list();
+    unsigned key_hash = hash(key);
+    hash_table_slot *slot = probe(table, key, key_hash);
+    if (slot->key_offset != EMPTY_SLOT) {
+        return &slot->value;
     }
-    list_append(*pair_list, new_pair);
-}
-
-/*******************************************************************************
-** Function: hash_table_get
-** Description: Returns value mapped to key, or -1 (UINT_MAX) if key not found
-** Parameters:
-**     - table: hash_table to search for key in
-**     - key: key to search for
-** Pre-Conditions: table and key are both non-null
-** Post-Conditions: A key_value_pair containing key and value was appended to
-**     the key-value pair linked list matching the hash value of key
-*******************************************************************************/
-unsigned hash_table_get(const hash_table *table, const char *key) {
-    assert_nonnull(table, "Error: Cannot search NULL hash table\n");
-    assert_nonnull(key, "Error: Cannot search for NULL key in hash table\n");
-    const key_value_pair *pair = lookup(table, key);
-    if (!pair) {
-        // key not found
-        return -1;
+    if ((table->num_keys + 1) * MAX_LOAD_DENOMINATOR
+            > table->capacity * MAX_LOAD_NUMERATOR) {
+        grow(table);
+        slot = probe(table, key, key_hash);
     }
-    return pair->value;
+    assert_condition(table->keys->len < EMPTY_SLOT,
+            "Error: Too many keys in hash table\n");
+    slot->key_offset = table->keys->len;
+    arena_append(table->keys, key, strlen(key) + 1);
+    slot->key_hash = key_hash;
+    slot->value = value;
+    table->num_keys++;
+    return &slot->value;
 }
 
 /*******************************************************************************
-** Function: hash_table_set
-** Description: Sets finds key value pair matching key and sets value to value.
-**     Returns true if succesful or false if key wasn't found
+** Function: grow
+** Description: Doubles the number of slots in table and moves every key to
+**     its slot in the larger array. Stored hashes are reused and keys stay
+**     where they are in the arena.
 ** Parameters:
-**     - table: hash_table to search for key in
-**     - key: Key to search for
-**     - value: Value to set value in key-value pair equal to
-** Pre-Conditions: table and key are both non-null
-** Post-Conditions: The key value pair whose key matches the provided key has 
-**     its value set to the provided value
+**     - table: hash_table to grow
+** Pre-Conditions: table is non-null
+** Post-Conditions: table->capacity has doubled
 *******************************************************************************/
-bool hash_table_set(const hash_table *table, const char *key, unsigned value) {
-    key_value_pair *pair = lookup(table, key);
-    if (!pair) {
-        return false;
+static void grow(hash_table *table) {
+    hash_table_slot *old_slots = table->slots;
+    unsigned old_capacity = table->capacity;
+    table->capacity *= 2;
+    table->slots = safe_malloc(table->capacity * sizeof(hash_table_slot));
+    for (unsigned i = 0; i < table->capacity; i++) {
+        table->slots[i].key_offset = EMPTY_SLOT;
     }
-    pair->value = value;
-    return true;
+    unsigned mask = table->capacity - 1;
+    for (unsigned i = 0; i < old_capacity; i++) {
+        if (old_slots[i].key_offset == EMPTY_SLOT) {
+            continue;
+        }
+        unsigned j = old_slots[i].key_hash & mask;
+        while (table->slots[j].key_offset != EMPTY_SLOT) {
+            j = (j + 1) & mask;
+        }
+        table->slots[j] = old_slots[i];
+    }
+    free(old_slots);
 }
 
 /*******************************************************************************
 ** Function: hash_table_print
-** Description: Prints each linked list within hash table to show collisions
+** Description: Prints each used slot within hash table to show collisions
 ** Parameters:
 **     - table: hash_table to print
 ** Pre-Conditions: table is non-null
@@ -178,62 +202,20 @@ bool hash_table_set(const hash_table *table, const char *key, unsigned value) {
 *******************************************************************************/
 void hash_table_print(const hash_table *table) {
     assert_nonnull(table, "Error: Cannot print NULL hash table\n");
-    for (int hash_value = 0; hash_value < table->size; hash_value++) {
-        const linked_list *pair_list = table->pair_lists[hash_value];
-        printf("%02d: ", hash_value);
-        if (pair_list) {
-            list_print(pair_list, &key_value_pair_to_string);
+    for (unsigned i = 0; i < table->capacity; i++) {
+        const hash_table_slot *slot = &table->slots[i];
+        if (slot->key_offset != EMPTY_SLOT) {
+            printf("%02u: {%s: %u} (home %02u)\n", i,
+                    table->keys->data + slot->key_offset, slot->value,
+                    slot->key_hash & (table->capacity - 1));
         }
-        printf("\n");
     }
 }
 
-/*******************************************************************************
-** Function: key_value_pair_to_string
-** Description: Generates a string representation of a key_value_pair
-** Parameters:
-**     - pair: key_value_pair to create string of
-** Pre-Conditions: If non-null, key and value can fit into
-**     KEY_VALUE_PAIR_MAX_STRING_LEN - 5 characters or less
-** Post-Conditions: Return value is non-null
-*******************************************************************************/
-static const char *key_value_pair_to_string(const void *pair) {
-    static char string[KEY_VALUE_PAIR_MAX_STR_LEN];
-    if (!pair) {
-        sprintf(string, "{NULL}");
-        return string;
-    }
-    const key_value_pair *kv_pair = pair;
-    const char *key = kv_pair->key;
-    unsigned value = kv_pair->value;
-    sprintf(string, "{%s: %d}", key, value);
-    return string;
-}
-
-
-/*******************************************************************************
-** Function: key_value_pair_has_key
-** Description: Checks whether the key in a key_value_pair matches a
-**     given string
-** Parameters:
-**     - pair: key_value_pair to check key of
-**     - compare: String to check if equal to key
-** Pre-Conditions: pair and compare are both non-null
-** Post-Conditions: N/A
-*******************************************************************************/
-static bool key_value_pair_has_key(const void *pair, const void *compare) {
-    assert_nonnull(pair, "Error: Cannot compare key of NULL key_value_pair\n");
-    assert_nonnull(compare, "Error: Cannot compare key of key_value_pair"
-            "to NULL string\n");
-    const key_value_pair *kv_pair = pair;
-    const char *key = kv_pair->key;
-    return strcmp(key, compare) == EXIT_SUCCESS;
-}
-
 /*******************************************************************************
 ** Function: hash_table_dispose
-** Description: Frees memory allocated to each linked list within table as well
-**     the table itself
+** Description: Frees memory allocated to the slots and keys within table as
+**     well the table itself
 ** Parameters:
 **     - table: hash_table to free momory allocated to
 ** Pre-Conditions: table is non-null
@@ -241,22 +223,7 @@ static bool key_value_pair_has_key(const void *pair, const void *compare) {
 *******************************************************************************/
 void hash_table_dispose(hash_table *table) {
     assert_nonnull(table, "Error: Cannot dispose NULL hash table\n");
-    for (int hash_value = 0; hash_value < table->size; hash_value++) {
-        linked_list *pair_list = table->pair_lists[hash_value];
-        if (pair_list) {
-            list_node *node = pair_list->head;
-            while(node) {
-                key_value_pair *pair = node->data;
-                free(pair->key);
-                free(pair);
-                list_node *next = node->next;
-                free(node);
-                node = next;
-            }
-            free(pair_list);
-        }
-    }
-    free(table->pair_lists);
+    free(table->slots);
+    arena_dispose(table->keys);
     free(table);
 }
-
@@ -3,25 +3,27 @@
 
 #include <stdbool.h>
 
-#include "linked_list.h"
+#include "arena.h"
 
+// one slot of the table; key_offset is EMPTY_SLOT while the slot is unused
 typedef struct {
-    char *key;
+    unsigned key_offset;  // offset of the key's characters in keys
+    unsigned key_hash;
     unsigned value;
-} key_value_pair;
+} hash_table_slot;
 
 typedef struct {
-    linked_list **pair_lists;
-    int size;
-} hash_table; 
+    hash_table_slot *slots;
+    unsigned capacity;  // always a power of two
+    unsigned num_keys;
+    arena *keys;        // null-terminated keys, one after another
+} hash_table;
 
 hash_table *hash_table_init(unsigned size);
-bool hash_table_contains(const hash_table *table, const char *key);
-void hash_table_add(const hash_table *table, const char *key, unsigned value);
-unsigned hash_table_get(const hash_table *table, const char *key);
-bool hash_table_set(const hash_table *table, const char *key, unsigned value);
+unsigned *hash_table_find(const hash_table *table, const char *key);
+unsigned *hash_table_find_or_insert(hash_table *table, const char *key,
+        unsigned value);
 void hash_table_print(const hash_table *table);
 void hash_table_dispose(hash_table *table);
 
 #endif
-
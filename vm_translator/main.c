@@ -5,11 +5,11 @@
 ** Description: Compile given .vm file(s) containing virtual machine
 **     code as specified in the Nand2Tetris course into assembly
 **     code to run on the Hack computer
-** Input: a filepath to either
+** Input: one or more filepaths, each to either
 **     - a file with a .vm extension
 **     - a directory containing one or more .vm files
-** Output: a .asm file containing the compiled assembly code to run
-**     on the Hack computer
+** Output: a .asm file, named after the first filepath, containing the
+**     compiled assembly code of all given files to run on the Hack computer
 *******************************************************************************/
 
 #include <dirent.h>
@@ -17,26 +17,34 @@
 #include <libgen.h>
 #include <limits.h>
 #include <linux/limits.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "asm_writer.h"
 #include "error_check.h"
 #include "hash_table.h"
 #include "linked_list.h"
 #include "parser.h"
+#include "program.h"
 
 #define VM_EXTENSION_LEN  3
 #define ASM_EXTENSION_LEN 4
 #define VM_EXTENSION  ".vm"
 #define ASM_EXTENSION ".asm"
+#define FRAGMENT_EXTENSION ".frag"
 #define NULL_TERMINAOTR_LEN 1
+#define VM_READ_LEN 4096
 #define MAX_VM_LINE   80
 #define MAX_ASM_LINE 160
+#define ROOT_FUNCTION "Sys.init"
+#define STATIC_FRAMES_START 256
+#define MAX_STATIC_FRAME_WORDS 512
 
 // file type of input
 typedef enum { VM_FILE, DIRECTORY } file_type;
@@ -48,16 +56,51 @@ typedef struct {
     file_type type;
 } input_info;
 
-static input_info parse_input_info(int argc, char **argv);
-static linked_list *get_vm_file_paths(const input_info input);
+// one .vm file and the fragment of assembly code it is translated into
+typedef struct {
+    const char *vm_file_path;
+    asm_fragment fragment;
+    bool translated;
+    bool cached;  // fragment was loaded from cache_dir
+} translation_job;
+
+// number of files to translate concurrently, set by -j
+static long num_workers;
+// directory that file fragments are saved to and reused from, set by -C
+static const char *cache_dir = NULL;
+// print how often each segment offset is used, set by -H
+static bool show_offset_histogram = false;
+static translation_job *jobs;
+static unsigned num_jobs;
+static unsigned next_job;
+// jobs before this one have been linked
+static unsigned next_link;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static writer_options parse_options(int argc, char **argv);
+static input_info parse_input_info(const char *relative_path);
+static void add_vm_file_paths(const input_info input,
+        linked_list *vm_file_paths);
+static void assert_unique_file_names(const linked_list *vm_file_paths);
+static void sort_paths(linked_list *paths);
+static int compare_paths(const void *path_a, const void *path_b);
 static char *get_root_file_name(const input_info input);
 static char *get_absolute_path(const char *dir_path, const char *file_name);
 static char *get_parent_dir_path(const char *path);
 static char *get_asm_file_path(const input_info input);
-static void generate_asm(const char *vm_file_path);
+static void generate_files_asm(const linked_list *vm_file_paths);
+static void *translation_worker(void *unused);
+static void generate_asm(translation_job *job);
+static bool load_cached_fragment(translation_job *job, const char *cache_path);
+static void save_cached_fragment(const translation_job *job,
+        const char *cache_path);
+static char *read_vm_code(const char *vm_file_path, size_t *vm_code_len);
+static unsigned generate_program_asm(const linked_list *vm_file_paths,
+        writer_options options);
 static bool is_dir(const char *path);
 static bool is_vm_file(const char *file_path);
 static bool contains_sys_file(const linked_list *vm_file_paths);
+static void print_offset_histogram(const offset_histogram *histogram);
 
 /*******************************************************************************
 ** Function: main
@@ -69,29 +112,169 @@ static bool contains_sys_file(const linked_list *vm_file_paths);
 ** Post-Conditions: compiled assembly code is written to .asm file
 *******************************************************************************/
 int main(int argc, char *argv[]) {
-    const input_info input = parse_input_info(argc, argv);
-    linked_list *vm_file_paths = get_vm_file_paths(input);
-    char *asm_file_absolute_path = get_asm_file_path(input);
+    const writer_options options = parse_options(argc, argv);
+    assert_condition(argc - optind >= 1,
+            "Usage:\n\n"
+            "To compile vm files and all vm files in directories into one "
+            "program:\n"
+            "$ vm_translator [-cetfbdsOH] [-i N] [-j N] [-C dir] "
+            "path/to/file.vm|path/to/dir ...\n\n"
+            "The program is written next to the first file or into the "
+            "first directory.\n\n"
+            "Options:\n"
+            "  -c  call and return through shared routines\n"
+            "  -e  compare (eq, lt, gt) through shared routines\n"
+            "  -t  keep the top of the stack in D within basic blocks\n"
+            "  -f  write push/pop pairs as direct moves\n"
+            "  -b  write compare-and-branch sequences as one jump\n"
+            "  -d  leave out functions Sys.init never calls\n"
+            "  -s  give functions that cannot recurse static frames\n"
+            "  -i N  inline functions of at most N commands (implies -s)\n"
+            "  -O  fold constant arithmetic within functions\n"
+            "  -H  show how often each local, argument, this and that "
+            "offset is used\n"
+            "  -j N  translate up to N files at once\n"
+            "  -C dir  reuse translated files saved in dir, and save "
+            "new ones there (not with -d, -s or -i)\n\n"
+    );
+    linked_list *vm_file_paths = new_linked_list();
+    char *asm_file_absolute_path = NULL;
+    for (int i = optind; i < argc; i++) {
+        const input_info input = parse_input_info(argv[i]);
+        add_vm_file_paths(input, vm_file_paths);
+        if (asm_file_absolute_path == NULL) {
+            asm_file_absolute_path = get_asm_file_path(input);
+        }
+        free(input.file_absolute_path);
+        free(input.dir_absolute_path);
+    }
+    assert_unique_file_names(vm_file_paths);
     printf("Writing to output file `%s'\n", asm_file_absolute_path);
-    free(input.file_absolute_path);
-    free(input.dir_absolute_path);
-    writer_init(asm_file_absolute_path);
+    writer_init(asm_file_absolute_path, options);
     free(asm_file_absolute_path);
-    if (contains_sys_file(vm_file_paths)) {
-        write_bootstrap();
-    }
-    for (list_node *node = vm_file_paths->head; node; node = node->next) {
-        const char *vm_file_absolute_path = node->data;
-        printf("Compiling vm file `%s'\n", vm_file_absolute_path);
-        generate_asm(vm_file_absolute_path);
+    unsigned removed_functions = 0;
+    if (options.remove_dead_functions || options.static_frames) {
+        removed_functions = generate_program_asm(vm_file_paths, options);
+    } else {
+        generate_files_asm(vm_file_paths);
     }
     writer_dispose();
     list_dispose(vm_file_paths);
+    if (options.shared_calls || options.shared_comparisons) {
+        printf("ROM size: %u words, %u without shared routines\n",
+                writer_rom_words(), writer_inline_rom_words());
+    } else {
+        printf("ROM size: %u words\n", writer_rom_words());
+    }
+    if (options.fuse_moves) {
+        printf("Fused %u push/pop pairs into moves\n", writer_fused_moves());
+    }
+    if (options.fold_constants) {
+        printf("Folded constants, removing %u vm commands\n",
+                writer_folded_commands());
+    }
+    if (options.remove_dead_functions) {
+        printf("Removed %u functions that are never called, "
+                "saving %u ROM words\n",
+                removed_functions, writer_discarded_rom_words());
+    }
+    if (show_offset_histogram) {
+        print_offset_histogram(writer_offset_histogram());
+    }
     printf("Compilation finished successfully\n");
 
     return EXIT_SUCCESS;
 }
 
+/*******************************************************************************
+** Function: parse_options
+** Description: Parse the code generation options that precede the input path
+**     - -c: call and return through one shared routine each
+**     - -e: compare through one shared routine each for eq, lt and gt
+**     - -t: keep the top of the stack in D within basic blocks
+**     - -f: write push/pop pairs as direct moves
+**     - -b: write eq/lt/gt, an optional not and if-goto as one jump
+**     - -d: leave out functions that cannot be called from Sys.init
+**     - -s: give functions that cannot recurse frames at fixed addresses
+**     - -i N: write the body of functions with a static frame and at most N
+**         commands in place of calls to them; implies -s
+**     - -O: fold constant arithmetic and drop operations that do nothing,
+**         one function at a time
+**     - -H: print the offset histogram with the other statistics
+**     - -j N: translate up to N files at once, by default one per processor
+**     - -C dir: save the fragment each file is translated into in dir, and
+**         link saved fragments instead of translating unchanged files again.
+**         -d, -s and -i translate the whole program at once, so -C is
+**         ignored with a warning when one of them is given.
+** Parameters:
+**     - argc: Number of provided command-line arguments
+**     - argv: List of provided comand-line arguments
+** Pre-Conditions: N/A
+** Post-Conditions: optind is the index of the first non-option argument,
+**     num_workers is at least 1
+*******************************************************************************/
+static writer_options parse_options(int argc, char **argv) {
+    writer_options options = {0};
+    num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int option;
+    while ((option = getopt(argc, argv, "cetfbdsi:OHj:C:")) != -1) {
+        switch (option) {
+            case 'c':
+                options.shared_calls = true;
+                break;
+            case 'e':
+                options.shared_comparisons = true;
+                break;
+            case 't':
+                options.cache_tos = true;
+                break;
+            case 'f':
+                options.fuse_moves = true;
+                break;
+            case 'b':
+                options.fuse_branches = true;
+                break;
+            case 'd':
+                options.remove_dead_functions = true;
+                break;
+            case 's':
+                options.static_frames = true;
+                break;
+            case 'i':
+                options.static_frames = true;
+                options.max_inline_commands = atoi(optarg);
+                break;
+            case 'O':
+                options.fold_constants = true;
+                break;
+            case 'H':
+                show_offset_histogram = true;
+                break;
+            case 'j':
+                num_workers = atoi(optarg);
+                break;
+            case 'C':
+                assert_condition(is_dir(optarg),
+                        "Error: cache directory `%s' does not exist\n",
+                        optarg);
+                cache_dir = optarg;
+                break;
+            default:
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    if (cache_dir != NULL
+            && (options.remove_dead_functions || options.static_frames)) {
+        fprintf(stderr, "Warning: -C has no effect with -d, -s or -i, which "
+                "translate the whole program at once\n");
+        cache_dir = NULL;
+    }
+    return options;
+}
+
 /*******************************************************************************
 ** Function: parse_input_info
 ** Description: Parse the following data into an input_info structure
@@ -101,23 +284,15 @@ int main(int argc, char *argv[]) {
 **                 containing inputted file
 **     If the given input is not a .vm file or directory path, exit with error
 ** Parameters:
-**     - argc: Number of provided command-line arguments
-**     - argv: List of provided comand-line arguments
-** Pre-Conditions: N/A
+**     - relative_path: Input path given on the command line
+** Pre-Conditions: relative_path is non-null
 ** Post-Conditions: All necessary fields of input will be set according to 
 **     input path. If inputted path is a directory, file_absolute_path will be
 **     null, but all other fields will be non-null.
 *******************************************************************************/
-static input_info parse_input_info(int argc, char **argv) {
-    assert_condition(argc == 2,
-            "Usage:\n\n"
-            "To compile a single vm file:\n"
-            "$ vm_translator path/to/file.vm\n\n"
-            "To compile all vm files in a directory:\n"
-            "$ vm_translator path/to/dir\n\n"
-    );
+static input_info parse_input_info(const char *relative_path) {
     input_info input;
-    char *relative_path = argv[1];
+
     if (is_dir(relative_path)) {
         input.type = DIRECTORY;
         input.file_absolute_path = NULL;
@@ -136,21 +311,26 @@ static input_info parse_input_info(int argc, char **argv) {
 
 
 /*******************************************************************************
-** Function: get_vm_file_paths
-** Description: Return a singly-linked list containing absoute paths to all .vm
-**     files to compile
+** Function: add_vm_file_paths
+** Description: Appends absolute paths to all .vm files of one input to a
+**     singly-linked list of files to compile
 ** Parameters:
 **     - input: Contains relevant fields of user input
-** Pre-Conditions: Fields of input are properly set.
-** Post-Conditions: Returned list is non-null and contains names of inputted .vm
-**     file or names of all .vm files in inputted directory
+**     - vm_file_paths: List to append the paths to
+** Pre-Conditions: Fields of input are properly set, vm_file_paths is non-null
+** Post-Conditions: Name of inputted .vm file or names of all .vm files in
+**     inputted directory have been appended to vm_file_paths, the latter
+**     sorted so that the output does not depend on the order readdir lists
+**     them in
 *******************************************************************************/
-static linked_list *get_vm_file_paths(const input_info input) {
-    linked_list *vm_file_paths = new_linked_list();
+static void add_vm_file_paths(const input_info input,
+        linked_list *vm_file_paths) {
+    linked_list *dir_file_paths = NULL;
     DIR *dir = NULL;
     char *file_path_copy = NULL;
     switch (input.type) {
         case DIRECTORY:
+            dir_file_paths = new_linked_list();
             dir = safe_opendir(input.dir_absolute_path);
             const struct dirent *dir_entry;
             while ((dir_entry = readdir(dir)) != NULL) {
@@ -158,19 +338,90 @@ static linked_list *get_vm_file_paths(const input_info input) {
                 char *absolute_path = get_absolute_path(
                         input.dir_absolute_path, file_name);
                 if (is_vm_file(absolute_path)) {
-                    list_append(vm_file_paths, absolute_path);
+                    list_append(dir_file_paths, absolute_path);
                 } else {
                     free(absolute_path);
                 }
             }
             safe_closedir(dir);
+            sort_paths(dir_file_paths);
+            for (list_node *node = dir_file_paths->head; node;
+                    node = node->next) {
+                list_append(vm_file_paths, node->data);
+                node->data = NULL;
+            }
+            list_dispose(dir_file_paths);
             break;
         case VM_FILE:
             file_path_copy = safe_strdup(input.file_absolute_path);
             list_append(vm_file_paths, file_path_copy);
             break;
     }
-    return vm_file_paths;
+}
+
+/*******************************************************************************
+** Function: assert_unique_file_names
+** Description: Exits with an error if two files to compile have the same name,
+**     such as the same class given twice. Their static variables and
+**     functions would share symbols.
+** Parameters:
+**     - vm_file_paths: paths of files to compile
+** Pre-Conditions: vm_file_paths is non-null and stores data of type char *
+** Post-Conditions: N/A
+*******************************************************************************/
+static void assert_unique_file_names(const linked_list *vm_file_paths) {
+    for (list_node *node = vm_file_paths->head; node; node = node->next) {
+        const char *file_name = strrchr(node->data, '/') + 1;
+        for (list_node *other = node->next; other; other = other->next) {
+            const char *other_file_name = strrchr(other->data, '/') + 1;
+            assert_condition(strcmp(file_name, other_file_name) != 0,
+                    "Error: `%s' and `%s' are both named `%s'\n",
+                    (char *) node->data, (char *) other->data, file_name);
+        }
+    }
+}
+
+/*******************************************************************************
+** Function: sort_paths
+** Description: Sorts a list of paths in strcmp order
+** Parameters:
+**     - paths: List of paths to sort
+** Pre-Conditions: paths is non-null and stores data of type char *
+** Post-Conditions: paths holds the same paths in ascending order
+*******************************************************************************/
+static void sort_paths(linked_list *paths) {
+    size_t num_paths = 0;
+    for (list_node *node = paths->head; node; node = node->next) {
+        num_paths++;
+    }
+    if (num_paths < 2) {
+        return;
+    }
+    char **path_array = safe_malloc(num_paths * sizeof(char *));
+    size_t i = 0;
+    for (list_node *node = paths->head; node; node = node->next) {
+        path_array[i++] = node->data;
+    }
+    qsort(path_array, num_paths, sizeof(char *), compare_paths);
+    i = 0;
+    for (list_node *node = paths->head; node; node = node->next) {
+        node->data = path_array[i++];
+    }
+    free(path_array);
+}
+
+/*******************************************************************************
+** Function: compare_paths
+** Description: qsort comparison function for an array of paths
+** Parameters:
+**     - path_a: Pointer to first path
+**     - path_b: Pointer to second path
+** Pre-Conditions: path_a and path_b point to non-null strings
+** Post-Conditions: Return value is negative, zero or positive as the first
+**     path sorts before, equal to or after the second
+*******************************************************************************/
+static int compare_paths(const void *path_a, const void *path_b) {
+    return strcmp(*(char *const *) path_a, *(char *const *) path_b);
 }
 
 /*******************************************************************************
@@ -196,8 +447,10 @@ static char *get_root_file_name(const input_info input) {
         case VM_FILE:
             file_name = strrchr(input.file_absolute_path, '/') + 1;
             root_len = strlen(file_name) - VM_EXTENSION_LEN;
-            root_file_name = safe_malloc(root_len * sizeof(char));
+            root_file_name = safe_malloc((root_len + NULL_TERMINAOTR_LEN)
+                    * sizeof(char));
             strncpy(root_file_name, file_name, root_len);
+            root_file_name[root_len] = '\0';
             break;
     }
     return root_file_name;
@@ -216,11 +469,11 @@ static char *get_root_file_name(const input_info input) {
 static char *get_file_name(const char *file_path) {
     const char *file_name_start = strrchr(file_path, '/') + 1;
     const char *file_name_end = strrchr(file_path, '.') - 1;
-    size_t name_size = (file_name_end - file_name_start + NULL_TERMINAOTR_LEN)
-            * sizeof(char);
-    char *file_name = safe_malloc(name_size);
-    strncpy(file_name, file_name_start, name_size);
-    file_name[name_size] = '\0';
+    size_t name_len = file_name_end - file_name_start + 1;
+    char *file_name = safe_malloc((name_len + NULL_TERMINAOTR_LEN)
+            * sizeof(char));
+    strncpy(file_name, file_name_start, name_len);
+    file_name[name_len] = '\0';
     return file_name;
 }
 
@@ -244,8 +497,10 @@ static char *get_parent_dir_path(const char *path) {
     assert_condition(parent_dir_end != NULL,
             "Error: invalid absolute path `%s'\n", path);
     size_t parent_dir_path_len = parent_dir_end - path + NULL_TERMINAOTR_LEN;
-    parent_dir_path = safe_malloc(parent_dir_path_len * sizeof(char));
+    parent_dir_path = safe_malloc((parent_dir_path_len + NULL_TERMINAOTR_LEN)
+            * sizeof(char));
     strncpy(parent_dir_path, path, parent_dir_path_len);
+    parent_dir_path[parent_dir_path_len] = '\0';
     return parent_dir_path;
 }
 
@@ -321,25 +576,308 @@ static bool is_vm_file(const char *file_path) {
     return S_ISREG(path_stat.st_mode);
 }
 
+/*******************************************************************************
+** Function: generate_files_asm
+** Description: Links the bootstrap code if there is a Sys.vm, then translates
+**     each .vm file into its own fragment of assembly code on up to
+**     num_workers threads. Fragments are linked in the order of
+**     vm_file_paths as soon as all earlier ones are, so finished code does
+**     not pile up in memory. Fragments do not share labels or counters, so
+**     the output is the same however the files are spread over the threads.
+** Parameters:
+**     - vm_file_paths: paths of files to compile
+** Pre-Conditions: vm_file_paths is non-null, writer_init has been called
+** Post-Conditions: Every file's code has been linked
+*******************************************************************************/
+static void generate_files_asm(const linked_list *vm_file_paths) {
+    num_jobs = 0;
+    for (list_node *node = vm_file_paths->head; node; node = node->next) {
+        num_jobs++;
+    }
+    jobs = safe_malloc(num_jobs * sizeof(translation_job));
+    unsigned job_index = 0;
+    for (list_node *node = vm_file_paths->head; node; node = node->next) {
+        jobs[job_index].vm_file_path = node->data;
+        jobs[job_index].translated = false;
+        jobs[job_index].cached = false;
+        printf("Compiling vm file `%s'\n", jobs[job_index].vm_file_path);
+        job_index++;
+    }
+
+    if (contains_sys_file(vm_file_paths)) {
+        asm_fragment bootstrap;
+        writer_begin_fragment("bootstrap");
+        write_bootstrap();
+        writer_end_fragment(&bootstrap);
+        writer_link_fragment(&bootstrap);
+    }
+    long num_threads = num_workers < num_jobs ? num_workers : num_jobs;
+    if (num_threads <= 1) {
+        translation_worker(NULL);
+    } else {
+        pthread_t workers[num_threads];
+        for (long i = 0; i < num_threads; i++) {
+            assert_condition(pthread_create(&workers[i], NULL,
+                    translation_worker, NULL) == 0,
+                    "Error: could not start worker thread\n");
+        }
+        for (long i = 0; i < num_threads; i++) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+    if (cache_dir != NULL) {
+        unsigned num_cached = 0;
+        for (unsigned i = 0; i < num_jobs; i++) {
+            num_cached += jobs[i].cached;
+        }
+        printf("Reused %u of %u translated files from `%s'\n", num_cached,
+                num_jobs, cache_dir);
+    }
+    free(jobs);
+}
+
+/*******************************************************************************
+** Function: translation_worker
+** Description: Translates files from jobs until none are left, linking each
+**     run of translated fragments that follows the last linked one
+** Parameters:
+**     - unused: Required by pthread_create
+** Pre-Conditions: jobs holds num_jobs jobs
+** Post-Conditions: Return value is NULL
+*******************************************************************************/
+static void *translation_worker(void *unused) {
+    while (true) {
+        pthread_mutex_lock(&jobs_lock);
+        unsigned job_index = next_job++;
+        pthread_mutex_unlock(&jobs_lock);
+        if (job_index >= num_jobs) {
+            return NULL;
+        }
+        generate_asm(&jobs[job_index]);
+        pthread_mutex_lock(&jobs_lock);
+        jobs[job_index].translated = true;
+        while (next_link < num_jobs && jobs[next_link].translated) {
+            writer_link_fragment(&jobs[next_link++].fragment);
+        }
+        pthread_mutex_unlock(&jobs_lock);
+    }
+}
+
 /*******************************************************************************
 ** Function: generate_asm
-** Description: Writes the compiled assembly code for each line of the given
-**     .vm file
+** Description: Writes the compiled assembly code for each line of the job's
+**     .vm file into the job's fragment. Generated labels start with the file
+**     name, which keeps them apart from other files' labels. With a
+**     cache_dir, a fragment saved there for the same file contents, name and
+**     options is loaded instead, and a newly translated fragment is saved.
 ** Parameters:
-**     - vm_file_path: path of file to compile
-** Pre-Conditions: vm_file_path is non-null
+**     - job: file to compile and fragment to compile it into
+** Pre-Conditions: job is non-null
+** Post-Conditions: job->fragment holds the file's code
+*******************************************************************************/
+static void generate_asm(translation_job *job) {
+    char vm_line[MAX_VM_LINE];
+    size_t vm_code_len;
+    char *vm_code = read_vm_code(job->vm_file_path, &vm_code_len);
+    char *vm_file_name = get_file_name(job->vm_file_path);
+    char *cache_path = NULL;
+    if (cache_dir != NULL) {
+        char cache_file_name[NAME_MAX + 1];
+        snprintf(cache_file_name, NAME_MAX + 1, "%s-%016llx" FRAGMENT_EXTENSION,
+                vm_file_name,
+                writer_fragment_key(vm_code, vm_code_len, vm_file_name));
+        cache_path = get_absolute_path(cache_dir, cache_file_name);
+        job->cached = load_cached_fragment(job, cache_path);
+    }
+    if (!job->cached) {
+        FILE *vm_file = fmemopen(vm_code, vm_code_len, "r");
+        assert_nonnull(vm_file, "Error: could not read `%s'\n",
+                job->vm_file_path);
+        writer_begin_fragment(vm_file_name);
+        set_current_vm_file_name(vm_file_name);
+        while ((get_line(vm_line, MAX_VM_LINE, vm_file)) != NULL) {
+            write_asm_instructions(vm_line);
+        }
+        writer_end_fragment(&job->fragment);
+        safe_fclose(vm_file);
+        if (cache_path != NULL) {
+            save_cached_fragment(job, cache_path);
+        }
+    }
+    free(cache_path);
+    free(vm_file_name);
+    free(vm_code);
+}
+
+/*******************************************************************************
+** Function: load_cached_fragment
+** Description: Loads the job's fragment from cache_path if a fragment has
+**     been saved there
+** Parameters:
+**     - job: job to load the fragment of
+**     - cache_path: path the fragment would have been saved to
+** Pre-Conditions: job and cache_path are non-null
+** Post-Conditions: Return value is true if job->fragment was loaded
+*******************************************************************************/
+static bool load_cached_fragment(translation_job *job, const char *cache_path) {
+    FILE *cache_file = fopen(cache_path, "r");
+    if (cache_file == NULL) {
+        return false;
+    }
+    bool loaded = writer_load_fragment(&job->fragment, cache_file);
+    safe_fclose(cache_file);
+    return loaded;
+}
+
+/*******************************************************************************
+** Function: save_cached_fragment
+** Description: Saves the job's fragment to cache_path. The fragment is written
+**     to a temporary file that is then renamed, so runs sharing cache_dir
+**     never see a partly written fragment. Failing to save only costs the
+**     next run a translation, so errors are ignored.
+** Parameters:
+**     - job: job whose fragment to save
+**     - cache_path: path to save the fragment to
+** Pre-Conditions: job->fragment was finished by writer_end_fragment and not
+**     yet linked, cache_path is non-null
 ** Post-Conditions: N/A
 *******************************************************************************/
-static void generate_asm(const char *vm_file_path) {
-    static char vm_line[MAX_VM_LINE];
+static void save_cached_fragment(const translation_job *job,
+        const char *cache_path) {
+    char temp_path[PATH_MAX];
+    snprintf(temp_path, PATH_MAX, "%s.XXXXXX", cache_path);
+    int temp_fd = mkstemp(temp_path);
+    if (temp_fd == -1) {
+        return;
+    }
+    FILE *temp_file = fdopen(temp_fd, "w");
+    if (temp_file == NULL) {
+        close(temp_fd);
+        unlink(temp_path);
+        return;
+    }
+    writer_save_fragment(&job->fragment, temp_file);
+    bool saved = !ferror(temp_file);
+    saved = fclose(temp_file) == 0 && saved;
+    if (!saved || rename(temp_path, cache_path) != 0) {
+        unlink(temp_path);
+    }
+}
+
+/*******************************************************************************
+** Function: read_vm_code
+** Description: Reads the whole contents of a .vm file into memory
+** Parameters:
+**     - vm_file_path: path of file to read
+**     - vm_code_len: Set to the number of characters read
+** Pre-Conditions: vm_file_path and vm_code_len are non-null
+** Post-Conditions: Return value is non-null and must be freed by the caller
+*******************************************************************************/
+static char *read_vm_code(const char *vm_file_path, size_t *vm_code_len) {
     FILE *vm_file = safe_fopen(vm_file_path, "r");
-    char *vm_file_name = get_file_name(vm_file_path);
-    set_current_vm_file_name(vm_file_name);
-    while ((get_line(vm_line, MAX_VM_LINE, vm_file)) != NULL) {
-        write_asm_instructions(vm_line);
+    size_t capacity = VM_READ_LEN;
+    char *vm_code = safe_malloc(capacity);
+    size_t len = 0;
+    size_t read_len;
+    while ((read_len = fread(vm_code + len, sizeof(char), capacity - len,
+            vm_file)) > 0) {
+        len += read_len;
+        if (len == capacity) {
+            capacity *= 2;
+            vm_code = realloc(vm_code, capacity);
+            assert_nonnull(vm_code, "Error allocating memory");
+        }
     }
-    free(vm_file_name);
+    assert_condition(!ferror(vm_file), "Error: could not read `%s'\n",
+            vm_file_path);
     safe_fclose(vm_file);
+    *vm_code_len = len;
+    return vm_code;
+}
+
+/*******************************************************************************
+** Function: generate_program_asm
+** Description: Reads every .vm file into memory, then writes the compiled
+**     assembly code of all functions in the order they were read. With
+**     remove_dead_functions, functions that cannot be reached through calls
+**     from Sys.init are translated in discard mode instead, so the ROM words
+**     they would take can be reported. With static_frames, functions that
+**     cannot recurse are given frames at fixed addresses below the stack;
+**     this needs the bootstrap code, which moves the stack past them. The
+**     smallest of those functions may then be inlined.
+** Parameters:
+**     - vm_file_paths: paths of files to compile
+**     - options: code generation options to translate with
+** Pre-Conditions: vm_file_paths is non-null
+** Post-Conditions: Return value is the number of functions left out
+*******************************************************************************/
+static unsigned generate_program_asm(const linked_list *vm_file_paths,
+        writer_options options) {
+    vm_program *program = program_init();
+    asm_fragment program_fragment;
+    for (list_node *node = vm_file_paths->head; node; node = node->next) {
+        const char *vm_file_absolute_path = node->data;
+        printf("Compiling vm file `%s'\n", vm_file_absolute_path);
+        char *vm_file_name = get_file_name(vm_file_absolute_path);
+        program_add_file(program, vm_file_absolute_path, vm_file_name);
+        free(vm_file_name);
+    }
+    unsigned removed_functions = 0;
+    if (options.remove_dead_functions) {
+        removed_functions = program->num_functions
+                - program_mark_reachable(program, ROOT_FUNCTION);
+    } else {
+        for (unsigned i = 0; i < program->num_functions; i++) {
+            program->functions[i].reachable = true;
+        }
+    }
+    bool has_bootstrap = contains_sys_file(vm_file_paths);
+    if (options.static_frames && has_bootstrap) {
+        unsigned frames_end = program_assign_static_frames(program,
+                STATIC_FRAMES_START, MAX_STATIC_FRAME_WORDS);
+        writer_use_static_frames(program, frames_end);
+        unsigned num_static = 0;
+        for (unsigned i = 0; i < program->num_functions; i++) {
+            num_static += program->functions[i].has_static_frame;
+        }
+        printf("Gave %u functions static frames in %u words of RAM\n",
+                num_static, frames_end - STATIC_FRAMES_START);
+        if (options.max_inline_commands > 0) {
+            printf("Inlined %u functions of at most %u commands\n",
+                    program_mark_inlined(program, options.max_inline_commands),
+                    options.max_inline_commands);
+        }
+        // every call to an inlined function is replaced by its body
+        for (unsigned i = 0; i < program->num_functions; i++) {
+            vm_function *function = &program->functions[i];
+            if (options.remove_dead_functions && function->inlined
+                    && function->reachable) {
+                function->reachable = false;
+                removed_functions++;
+            }
+        }
+    }
+    // labels are made unique within the whole program, so they need no prefix
+    writer_begin_fragment("");
+    if (has_bootstrap) {
+        write_bootstrap();
+    }
+    unsigned file_index = program->num_files;
+    for (unsigned i = 0; i < program->num_functions; i++) {
+        const vm_function *function = &program->functions[i];
+        if (function->file_index != file_index) {
+            file_index = function->file_index;
+            set_current_vm_file_name(program->file_names[file_index]);
+        }
+        writer_set_discard(!function->reachable);
+        for (unsigned j = 0; j < function->num_lines; j++) {
+            write_asm_instructions(function->lines[j]);
+        }
+    }
+    writer_end_fragment(&program_fragment);
+    writer_link_fragment(&program_fragment);
+    program_dispose(program);
+    return removed_functions;
 }
 
 /*******************************************************************************
@@ -362,3 +900,42 @@ static bool contains_sys_file(const linked_list *vm_file_paths) {
     return false;
 }
 
+/*******************************************************************************
+** Function: print_offset_histogram
+** Description: Prints how many times each offset of local, argument, this and
+**     that is accessed, with the ROM words saved by stepping from the segment
+**     pointer instead of adding the offset to it, as accesses/words saved
+** Parameters:
+**     - histogram: Offset histogram of the whole program
+** Pre-Conditions: histogram is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static void print_offset_histogram(const offset_histogram *histogram) {
+    static const char *const segment_names[NUM_POINTER_SEGMENTS] = {
+        "local", "argument", "this", "that"
+    };
+    unsigned total_saved_words = 0;
+    printf("Segment offsets (accesses/ROM words saved):\n");
+    printf("%6s", "offset");
+    for (unsigned segment = 0; segment < NUM_POINTER_SEGMENTS; segment++) {
+        printf(" %14s", segment_names[segment]);
+    }
+    printf("\n");
+    for (unsigned bucket = 0; bucket < NUM_OFFSET_BUCKETS; bucket++) {
+        if (bucket == NUM_OFFSET_BUCKETS - 1) {
+            printf("%5u+", bucket);
+        } else {
+            printf("%6u", bucket);
+        }
+        for (unsigned segment = 0; segment < NUM_POINTER_SEGMENTS; segment++) {
+            char cell[32];
+            snprintf(cell, sizeof(cell), "%u/%u",
+                    histogram->accesses[segment][bucket],
+                    histogram->saved_words[segment][bucket]);
+            printf(" %14s", cell);
+            total_saved_words += histogram->saved_words[segment][bucket];
+        }
+        printf("\n");
+    }
+    printf("Small offsets saved %u ROM words\n", total_saved_words);
+}
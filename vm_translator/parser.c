@@ -10,10 +10,67 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include "error_check.h"
 #include "parser.h"
 
+// kinds of arguments that follow each operator
+typedef enum {
+    ARGS_NONE,
+    ARGS_SEGMENT_INDEX,
+    ARGS_NAME,
+    ARGS_NAME_COUNT
+} operator_args;
+
+static const char *const operator_names[NUM_VM_OPERATORS] = {
+    [OP_PUSH]     = "push",
+    [OP_POP]      = "pop",
+    [OP_ADD]      = "add",
+    [OP_SUB]      = "sub",
+    [OP_NEG]      = "neg",
+    [OP_EQ]       = "eq",
+    [OP_LT]       = "lt",
+    [OP_GT]       = "gt",
+    [OP_AND]      = "and",
+    [OP_OR]       = "or",
+    [OP_NOT]      = "not",
+    [OP_LABEL]    = "label",
+    [OP_GOTO]     = "goto",
+    [OP_IF_GOTO]  = "if-goto",
+    [OP_CALL]     = "call",
+    [OP_FUNCTION] = "function",
+    [OP_RETURN]   = "return"
+};
+
+static const operator_args operator_arg_kinds[NUM_VM_OPERATORS] = {
+    [OP_PUSH]     = ARGS_SEGMENT_INDEX,
+    [OP_POP]      = ARGS_SEGMENT_INDEX,
+    [OP_LABEL]    = ARGS_NAME,
+    [OP_GOTO]     = ARGS_NAME,
+    [OP_IF_GOTO]  = ARGS_NAME,
+    [OP_CALL]     = ARGS_NAME_COUNT,
+    [OP_FUNCTION] = ARGS_NAME_COUNT
+};
+
+static const char *const segment_names[NUM_SEGMENTS] = {
+    [SEG_LOCAL]    = "local",
+    [SEG_ARGUMENT] = "argument",
+    [SEG_THIS]     = "this",
+    [SEG_THAT]     = "that",
+    [SEG_CONSTANT] = "constant",
+    [SEG_STATIC]   = "static",
+    [SEG_TEMP]     = "temp",
+    [SEG_POINTER]  = "pointer"
+};
+
 static void remove_comments(const char *vm_line);
 static void remove_newlines(char *vm_line);
+static const char *next_token(const char *vm_line, size_t *token_len);
+static int find_operator(const char *token, size_t token_len);
+static int find_segment(const char *token, size_t token_len);
+static int confirm_name(const char *const *names, int index,
+        const char *token, size_t token_len);
+static unsigned parse_unsigned(const char *token, size_t token_len,
+        const char *vm_line);
 
 /*******************************************************************************
 ** Function: get_line
@@ -73,3 +130,204 @@ static void remove_newlines(char *vm_line) {
     }
 }
 
+
+/*******************************************************************************
+** Function: parse_vm_line
+** Description: Splits a line of vm code into its operator, segment, operand and
+**     value in a single pass. Operator and segment names are looked up in
+**     tables indexed by their enums.
+** Parameters:
+**     - vm_line: line of vm code without comments or newlines
+**     - instruction: parsed line
+** Pre-Conditions: vm_line and instruction are non-null
+** Post-Conditions: Fields of instruction that the operator does not take are
+**     set to SEG_NONE, "" and 0. Exits with an error on a malformed line.
+*******************************************************************************/
+void parse_vm_line(const char *vm_line, vm_instruction *instruction) {
+    size_t token_len;
+    const char *token = next_token(vm_line, &token_len);
+    int operator = find_operator(token, token_len);
+    assert_condition(operator >= 0, "Error: invalid operator \"%.*s\"\n",
+            (int) token_len, token);
+    instruction->operator = operator;
+    instruction->segment = SEG_NONE;
+    instruction->operand[0] = '\0';
+    instruction->value = 0;
+
+    switch (operator_arg_kinds[operator]) {
+        case ARGS_NONE:
+            break;
+        case ARGS_SEGMENT_INDEX:
+            token = next_token(token + token_len, &token_len);
+            int segment = find_segment(token, token_len);
+            assert_condition(segment >= 0, "Error: invalid segment in `%s'\n",
+                    vm_line);
+            instruction->segment = segment;
+            token = next_token(token + token_len, &token_len);
+            instruction->value = parse_unsigned(token, token_len, vm_line);
+            break;
+        case ARGS_NAME:
+        case ARGS_NAME_COUNT:
+            token = next_token(token + token_len, &token_len);
+            assert_condition(token_len > 0 && token_len < MAX_OPERAND_LEN,
+                    "Error: invalid name in `%s'\n", vm_line);
+            memcpy(instruction->operand, token, token_len);
+            instruction->operand[token_len] = '\0';
+            if (operator_arg_kinds[operator] == ARGS_NAME_COUNT) {
+                token = next_token(token + token_len, &token_len);
+                instruction->value = parse_unsigned(token, token_len, vm_line);
+            }
+            break;
+    }
+}
+
+/*******************************************************************************
+** Function: next_token
+** Description: Returns the start of the next whitespace-separated token
+** Parameters:
+**     - vm_line: position in the line to search from
+**     - token_len: set to the length of the token, 0 at the end of the line
+** Pre-Conditions: vm_line and token_len are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static const char *next_token(const char *vm_line, size_t *token_len) {
+    while (isspace((unsigned char) *vm_line)) {
+        vm_line++;
+    }
+    const char *token_end = vm_line;
+    while (*token_end != '\0' && !isspace((unsigned char) *token_end)) {
+        token_end++;
+    }
+    *token_len = token_end - vm_line;
+    return vm_line;
+}
+
+/*******************************************************************************
+** Function: find_operator
+** Description: Returns the operator named by token, or -1 if there is none.
+**     The length and a letter or two pick the only operator it can be, so one
+**     comparison confirms it.
+** Parameters:
+**     - token: token to look up, not null-terminated
+**     - token_len: length of token
+** Pre-Conditions: token is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static int find_operator(const char *token, size_t token_len) {
+    int operator;
+    switch (token_len) {
+        case 2:
+            operator = token[0] == 'e' ? OP_EQ : token[0] == 'l' ? OP_LT
+                    : token[0] == 'g' ? OP_GT : OP_OR;
+            break;
+        case 3:
+            switch (token[0]) {
+                case 'a':
+                    operator = token[1] == 'd' ? OP_ADD : OP_AND;
+                    break;
+                case 'n':
+                    operator = token[1] == 'e' ? OP_NEG : OP_NOT;
+                    break;
+                case 's':
+                    operator = OP_SUB;
+                    break;
+                default:
+                    operator = OP_POP;
+                    break;
+            }
+            break;
+        case 4:
+            operator = token[0] == 'p' ? OP_PUSH : token[0] == 'c' ? OP_CALL
+                    : OP_GOTO;
+            break;
+        case 5:
+            operator = OP_LABEL;
+            break;
+        case 6:
+            operator = OP_RETURN;
+            break;
+        case 7:
+            operator = OP_IF_GOTO;
+            break;
+        case 8:
+            operator = OP_FUNCTION;
+            break;
+        default:
+            return -1;
+    }
+    return confirm_name(operator_names, operator, token, token_len);
+}
+
+/*******************************************************************************
+** Function: find_segment
+** Description: Returns the segment named by token, or -1 if there is none,
+**     picking the candidate the same way as find_operator
+** Parameters:
+**     - token: token to look up, not null-terminated
+**     - token_len: length of token
+** Pre-Conditions: token is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static int find_segment(const char *token, size_t token_len) {
+    int segment;
+    switch (token_len) {
+        case 4:
+            segment = token[1] == 'e' ? SEG_TEMP : token[2] == 'i' ? SEG_THIS
+                    : SEG_THAT;
+            break;
+        case 5:
+            segment = SEG_LOCAL;
+            break;
+        case 6:
+            segment = SEG_STATIC;
+            break;
+        case 7:
+            segment = SEG_POINTER;
+            break;
+        case 8:
+            segment = token[0] == 'a' ? SEG_ARGUMENT : SEG_CONSTANT;
+            break;
+        default:
+            return -1;
+    }
+    return confirm_name(segment_names, segment, token, token_len);
+}
+
+/*******************************************************************************
+** Function: confirm_name
+** Description: Returns index if token is the name at index in names, or -1
+** Parameters:
+**     - names: table of names
+**     - index: index of the candidate name
+**     - token: token to compare, not null-terminated
+**     - token_len: length of token, which is the length of the candidate
+** Pre-Conditions: names and token are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static int confirm_name(const char *const *names, int index,
+        const char *token, size_t token_len) {
+    return memcmp(names[index], token, token_len) == 0 ? index : -1;
+}
+
+/*******************************************************************************
+** Function: parse_unsigned
+** Description: Returns the value of a token of decimal digits
+** Parameters:
+**     - token: token to convert, not null-terminated
+**     - token_len: length of token
+**     - vm_line: line the token came from, for error messages
+** Pre-Conditions: token and vm_line are non-null
+** Post-Conditions: Exits with an error if the token is not a number
+*******************************************************************************/
+static unsigned parse_unsigned(const char *token, size_t token_len,
+        const char *vm_line) {
+    assert_condition(token_len > 0, "Error: missing number in `%s'\n",
+            vm_line);
+    unsigned value = 0;
+    for (size_t i = 0; i < token_len; i++) {
+        assert_condition(isdigit((unsigned char) token[i]),
+                "Error: invalid number in `%s'\n", vm_line);
+        value = value * 10 + (token[i] - '0');
+    }
+    return value;
+}
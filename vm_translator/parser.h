@@ -1,7 +1,54 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stdbool.h>
+#include <stdio.h>
+
+#define MAX_OPERAND_LEN 50
+
+typedef enum {
+    OP_PUSH,
+    OP_POP,
+    OP_ADD,
+    OP_SUB,
+    OP_NEG,
+    OP_EQ,
+    OP_LT,
+    OP_GT,
+    OP_AND,
+    OP_OR,
+    OP_NOT,
+    OP_LABEL,
+    OP_GOTO,
+    OP_IF_GOTO,
+    OP_CALL,
+    OP_FUNCTION,
+    OP_RETURN,
+    NUM_VM_OPERATORS
+} vm_operator;
+
+typedef enum {
+    SEG_LOCAL,
+    SEG_ARGUMENT,
+    SEG_THIS,
+    SEG_THAT,
+    SEG_CONSTANT,
+    SEG_STATIC,
+    SEG_TEMP,
+    SEG_POINTER,
+    NUM_SEGMENTS,
+    SEG_NONE = NUM_SEGMENTS
+} vm_segment;
+
+// one tokenized line of vm code
+typedef struct {
+    vm_operator operator;
+    vm_segment segment;             // push and pop
+    char operand[MAX_OPERAND_LEN];  // label, goto, if-goto, call and function
+    unsigned value;                 // push, pop, call and function
+} vm_instruction;
+
 char *get_line(char *vm_line, int max_line, FILE *vm_file);
+void parse_vm_line(const char *vm_line, vm_instruction *instruction);
 
 #endif
-
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error_check.h"
+#include "parser.h"
+#include "program.h"
+
+#define MAX_VM_LINE 80
+#define INITIAL_CAPACITY 16
+#define FUNCTION_TABLE_SIZE 1024
+
+// state of the depth-first walk that finds the strongly connected components
+// of the call graph, i.e. the groups of functions that can call each other
+typedef struct {
+    vm_program *program;
+    unsigned *visit_order;  // 0 until visited, then order of visit from 1
+    unsigned *lowlink;
+    bool *on_stack;
+    unsigned *stack;
+    unsigned stack_len;
+    unsigned *component;
+    unsigned *finished;     // functions by component, callees first
+    unsigned num_finished;
+    unsigned next_visit;
+    unsigned num_components;
+} call_graph_walk;
+
+static vm_function *add_function(vm_program *program, const char *name,
+        unsigned num_locals, unsigned file_index);
+static void add_call(vm_function *function, const char *callee,
+        unsigned num_args);
+static int find_function_index(const vm_program *program, const char *name);
+static void visit_function(call_graph_walk *walk, unsigned function_index);
+static bool calls_itself(const vm_program *program, unsigned function_index);
+static unsigned get_frame_words(const vm_function *function);
+static void append_string(char ***strings, unsigned *num_strings,
+        unsigned *capacity, const char *string);
+static void *grow(void *array, unsigned *capacity, size_t element_size);
+
+/*******************************************************************************
+** Function: program_init
+** Description: Allocates an empty program
+** Parameters: void
+** Pre-Conditions: N/A
+** Post-Conditions: Return value is non-null
+*******************************************************************************/
+vm_program *program_init() {
+    vm_program *program = safe_malloc(sizeof(vm_program));
+    memset(program, 0, sizeof(vm_program));
+    program->function_indices = hash_table_init(FUNCTION_TABLE_SIZE);
+    return program;
+}
+
+/*******************************************************************************
+** Function: program_add_file
+** Description: Reads every line of a vm file into the program, splitting it
+**     into functions at each function command and recording the functions each
+**     one calls. Lines before the first function command of the file are kept
+**     as a function with no name.
+** Parameters:
+**     - program: Program to add the file to
+**     - vm_file_path: Path of the vm file to read
+**     - vm_file_name: Name of the file without directory or extension, used
+**         for its static symbols
+** Pre-Conditions: All parameters are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+void program_add_file(vm_program *program, const char *vm_file_path,
+        const char *vm_file_name) {
+    static char vm_line[MAX_VM_LINE];
+    FILE *vm_file = safe_fopen(vm_file_path, "r");
+    unsigned file_index = program->num_files;
+    append_string(&program->file_names, &program->num_files,
+            &program->files_capacity, vm_file_name);
+    vm_function *function = NULL;
+    vm_instruction args;
+    while ((get_line(vm_line, MAX_VM_LINE, vm_file)) != NULL) {
+        parse_vm_line(vm_line, &args);
+        if (args.operator == OP_FUNCTION) {
+            function = add_function(program, args.operand, args.value,
+                    file_index);
+        } else if (function == NULL) {
+            function = add_function(program, NULL, 0, file_index);
+        }
+        if (args.operator == OP_CALL) {
+            add_call(function, args.operand, args.value);
+        } else if (args.segment == SEG_ARGUMENT
+                && args.value >= function->num_args) {
+            function->num_args = args.value + 1;
+        } else if (args.operator == OP_POP && args.segment == SEG_POINTER) {
+            function->sets_this |= args.value == 0;
+            function->sets_that |= args.value == 1;
+        }
+        append_string(&function->lines, &function->num_lines,
+                &function->lines_capacity, vm_line);
+    }
+    safe_fclose(vm_file);
+}
+
+/*******************************************************************************
+** Function: program_find_function
+** Description: Returns the function with the given name, or NULL if the
+**     program does not define it
+** Parameters:
+**     - program: Program to search
+**     - name: Name of the function to find
+** Pre-Conditions: program and name are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+vm_function *program_find_function(const vm_program *program,
+        const char *name) {
+    const unsigned *function_index = hash_table_find(
+            program->function_indices, name);
+    if (function_index == NULL) {
+        return NULL;
+    }
+    return &program->functions[*function_index];
+}
+
+/*******************************************************************************
+** Function: program_mark_reachable
+** Description: Marks every function that can be reached through call commands
+**     from the root function or from code outside any function. If the program
+**     does not define the root function, every function is marked reachable.
+** Parameters:
+**     - program: Program to mark the functions of
+**     - root_name: Name of the function execution starts at
+** Pre-Conditions: program and root_name are non-null
+** Post-Conditions: Return value is the number of reachable functions
+*******************************************************************************/
+unsigned program_mark_reachable(vm_program *program, const char *root_name) {
+    vm_function *root = program_find_function(program, root_name);
+    vm_function **stack = safe_malloc((program->num_functions + 1)
+            * sizeof(vm_function *));
+    unsigned stack_len = 0;
+    unsigned num_reachable = 0;
+    for (unsigned i = 0; i < program->num_functions; i++) {
+        vm_function *function = &program->functions[i];
+        function->reachable = root == NULL || function->name == NULL;
+        if (function->reachable) {
+            stack[stack_len++] = function;
+            num_reachable++;
+        }
+    }
+    if (root != NULL) {
+        root->reachable = true;
+        stack[stack_len++] = root;
+        num_reachable++;
+    }
+    // each function is pushed at most once, when it is first marked
+    while (stack_len > 0) {
+        vm_function *function = stack[--stack_len];
+        for (unsigned i = 0; i < function->num_calls; i++) {
+            vm_function *callee = program_find_function(program,
+                    function->calls[i].callee);
+            if (callee != NULL && !callee->reachable) {
+                callee->reachable = true;
+                stack[stack_len++] = callee;
+                num_reachable++;
+            }
+        }
+    }
+    free(stack);
+    return num_reachable;
+}
+
+/*******************************************************************************
+** Function: program_assign_static_frames
+** Description: Gives every function that cannot be active more than once at a
+**     time a frame at a fixed address. A function can be active more than once
+**     only if it can call itself, directly or through other functions, so the
+**     call graph is split into strongly connected components and only
+**     functions alone in a component that do not call themselves qualify.
+**     Frames are overlaid: components are visited callers first, and each
+**     frame starts after the frames of every function that can be active
+**     below it, so functions that are never active together share addresses.
+** Parameters:
+**     - program: Program to assign frames in
+**     - frames_start: First RAM address to put frames at
+**     - max_frame_words: Number of words frames may take; functions whose
+**         frame would not fit keep a dynamic frame
+** Pre-Conditions: program is non-null
+** Post-Conditions: Return value is the first address after all frames
+*******************************************************************************/
+unsigned program_assign_static_frames(vm_program *program,
+        unsigned frames_start, unsigned max_frame_words) {
+    unsigned num_functions = program->num_functions;
+    for (unsigned i = 0; i < num_functions; i++) {
+        const vm_function *function = &program->functions[i];
+        for (unsigned j = 0; j < function->num_calls; j++) {
+            vm_function *callee = program_find_function(program,
+                    function->calls[j].callee);
+            if (callee != NULL && function->calls[j].num_args
+                    > callee->num_args) {
+                callee->num_args = function->calls[j].num_args;
+            }
+        }
+    }
+    call_graph_walk walk = {
+        .program = program,
+        .visit_order = calloc(num_functions + 1, sizeof(unsigned)),
+        .lowlink = calloc(num_functions + 1, sizeof(unsigned)),
+        .on_stack = calloc(num_functions + 1, sizeof(bool)),
+        .stack = calloc(num_functions + 1, sizeof(unsigned)),
+        .component = calloc(num_functions + 1, sizeof(unsigned)),
+        .finished = calloc(num_functions + 1, sizeof(unsigned))
+    };
+    // words below which each function's frame may not start
+    unsigned *frame_floor = calloc(num_functions + 1, sizeof(unsigned));
+    assert_condition(walk.visit_order && walk.lowlink && walk.on_stack
+            && walk.stack && walk.component && walk.finished && frame_floor,
+            "Error allocating memory");
+    for (unsigned i = 0; i < num_functions; i++) {
+        if (walk.visit_order[i] == 0) {
+            visit_function(&walk, i);
+        }
+    }
+    unsigned frames_end = 0;
+    unsigned end = walk.num_finished;
+    while (end > 0) {
+        unsigned component = walk.component[walk.finished[end - 1]];
+        unsigned start = end;
+        unsigned floor = 0;
+        while (start > 0 && walk.component[walk.finished[start - 1]]
+                == component) {
+            start--;
+            if (frame_floor[walk.finished[start]] > floor) {
+                floor = frame_floor[walk.finished[start]];
+            }
+        }
+        unsigned ceiling = floor;
+        if (end - start == 1) {
+            unsigned function_index = walk.finished[start];
+            vm_function *function = &program->functions[function_index];
+            unsigned frame_words = get_frame_words(function);
+            if (function->name != NULL
+                    && !calls_itself(program, function_index)
+                    && floor + frame_words <= max_frame_words) {
+                function->has_static_frame = true;
+                function->frame_base = frames_start + floor;
+                ceiling = floor + frame_words;
+            }
+        }
+        if (ceiling > frames_end) {
+            frames_end = ceiling;
+        }
+        for (unsigned i = start; i < end; i++) {
+            const vm_function *function =
+                    &program->functions[walk.finished[i]];
+            for (unsigned j = 0; j < function->num_calls; j++) {
+                int callee = find_function_index(program,
+                        function->calls[j].callee);
+                if (callee >= 0 && walk.component[callee] != component
+                        && frame_floor[callee] < ceiling) {
+                    frame_floor[callee] = ceiling;
+                }
+            }
+        }
+        end = start;
+    }
+    free(walk.visit_order);
+    free(walk.lowlink);
+    free(walk.on_stack);
+    free(walk.stack);
+    free(walk.component);
+    free(walk.finished);
+    free(frame_floor);
+    return frames_start + frames_end;
+}
+
+/*******************************************************************************
+** Function: program_mark_inlined
+** Description: Marks the functions with a static frame whose body, not counting
+**     the function command, has at most max_commands commands. Functions
+**     with a static frame cannot recurse, so inlining them always ends.
+** Parameters:
+**     - program: Program to mark the functions of
+**     - max_commands: Largest body to inline
+** Pre-Conditions: program is non-null, program_assign_static_frames has been
+**     called
+** Post-Conditions: Return value is the number of functions marked
+*******************************************************************************/
+unsigned program_mark_inlined(vm_program *program, unsigned max_commands) {
+    unsigned num_inlined = 0;
+    for (unsigned i = 0; i < program->num_functions; i++) {
+        vm_function *function = &program->functions[i];
+        function->inlined = function->has_static_frame
+                && function->num_lines - 1 <= max_commands;
+        num_inlined += function->inlined;
+    }
+    return num_inlined;
+}
+
+/*******************************************************************************
+** Function: program_dispose
+** Description: Frees the program and everything read into it
+** Parameters:
+**     - program: Program to free
+** Pre-Conditions: program is non-null
+** Post-Conditions: program is freed
+*******************************************************************************/
+void program_dispose(vm_program *program) {
+    for (unsigned i = 0; i < program->num_functions; i++) {
+        vm_function *function = &program->functions[i];
+        for (unsigned j = 0; j < function->num_lines; j++) {
+            free(function->lines[j]);
+        }
+        for (unsigned j = 0; j < function->num_calls; j++) {
+            free(function->calls[j].callee);
+        }
+        free(function->name);
+        free(function->lines);
+        free(function->calls);
+    }
+    for (unsigned i = 0; i < program->num_files; i++) {
+        free(program->file_names[i]);
+    }
+    free(program->file_names);
+    free(program->functions);
+    hash_table_dispose(program->function_indices);
+    free(program);
+}
+
+/*******************************************************************************
+** Function: add_function
+** Description: Appends an empty function to the program. Named functions are
+**     added to the name lookup table; if two files define the same function,
+**     calls resolve to the first.
+** Parameters:
+**     - program: Program to add the function to
+**     - name: Name of the function, or NULL for code outside any function
+**     - num_locals: Number of local variables of the function
+**     - file_index: Index of the file the function is read from
+** Pre-Conditions: program is non-null
+** Post-Conditions: Return value is non-null and valid until the next function
+**     is added
+*******************************************************************************/
+static vm_function *add_function(vm_program *program, const char *name,
+        unsigned num_locals, unsigned file_index) {
+    if (program->num_functions == program->functions_capacity) {
+        program->functions = grow(program->functions,
+                &program->functions_capacity, sizeof(vm_function));
+    }
+    vm_function *function = &program->functions[program->num_functions];
+    memset(function, 0, sizeof(vm_function));
+    function->num_locals = num_locals;
+    function->file_index = file_index;
+    if (name != NULL) {
+        function->name = safe_strdup(name);
+        hash_table_find_or_insert(program->function_indices, name,
+                program->num_functions);
+    }
+    program->num_functions++;
+    return function;
+}
+
+/*******************************************************************************
+** Function: add_call
+** Description: Records a call command of a function
+** Parameters:
+**     - function: Function making the call
+**     - callee: Name of the function called
+**     - num_args: Number of arguments passed
+** Pre-Conditions: function and callee are non-null
+** Post-Conditions: function->num_calls has been incremented
+*******************************************************************************/
+static void add_call(vm_function *function, const char *callee,
+        unsigned num_args) {
+    if (function->num_calls == function->calls_capacity) {
+        function->calls = grow(function->calls, &function->calls_capacity,
+                sizeof(vm_call));
+    }
+    vm_call *call = &function->calls[function->num_calls++];
+    call->callee = safe_strdup(callee);
+    call->num_args = num_args;
+}
+
+/*******************************************************************************
+** Function: find_function_index
+** Description: Returns the index of the function with the given name, or -1
+**     if the program does not define it
+** Parameters:
+**     - program: Program to search
+**     - name: Name of the function to find
+** Pre-Conditions: program and name are non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static int find_function_index(const vm_program *program, const char *name) {
+    vm_function *function = program_find_function(program, name);
+    return function == NULL ? -1 : function - program->functions;
+}
+
+/*******************************************************************************
+** Function: visit_function
+** Description: Visits a function and everything it calls that has not been
+**     visited yet (Tarjan's algorithm). A function whose lowlink is its own
+**     visit order is the first visited of its component, which is then popped
+**     off the stack. Components therefore finish callees first.
+** Parameters:
+**     - walk: State of the walk
+**     - function_index: Index of the function to visit
+** Pre-Conditions: walk is non-null, the function has not been visited
+** Post-Conditions: The function has been assigned a component
+*******************************************************************************/
+static void visit_function(call_graph_walk *walk, unsigned function_index) {
+    walk->visit_order[function_index] = ++walk->next_visit;
+    walk->lowlink[function_index] = walk->next_visit;
+    walk->stack[walk->stack_len++] = function_index;
+    walk->on_stack[function_index] = true;
+    const vm_function *function = &walk->program->functions[function_index];
+    for (unsigned i = 0; i < function->num_calls; i++) {
+        int callee = find_function_index(walk->program,
+                function->calls[i].callee);
+        if (callee < 0) {
+            continue;
+        }
+        if (walk->visit_order[callee] == 0) {
+            visit_function(walk, callee);
+            if (walk->lowlink[callee] < walk->lowlink[function_index]) {
+                walk->lowlink[function_index] = walk->lowlink[callee];
+            }
+        } else if (walk->on_stack[callee] && walk->visit_order[callee]
+                < walk->lowlink[function_index]) {
+            walk->lowlink[function_index] = walk->visit_order[callee];
+        }
+    }
+    if (walk->lowlink[function_index] != walk->visit_order[function_index]) {
+        return;
+    }
+    unsigned member;
+    do {
+        member = walk->stack[--walk->stack_len];
+        walk->on_stack[member] = false;
+        walk->component[member] = walk->num_components;
+        walk->finished[walk->num_finished++] = member;
+    } while (member != function_index);
+    walk->num_components++;
+}
+
+/*******************************************************************************
+** Function: calls_itself
+** Description: Returns true if a function contains a call to itself
+** Parameters:
+**     - program: Program containing the function
+**     - function_index: Index of the function
+** Pre-Conditions: program is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static bool calls_itself(const vm_program *program, unsigned function_index) {
+    const vm_function *function = &program->functions[function_index];
+    for (unsigned i = 0; i < function->num_calls; i++) {
+        if (strcmp(function->calls[i].callee, function->name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*******************************************************************************
+** Function: get_frame_words
+** Description: Returns the number of words a static frame for the function
+**     takes: its arguments, its locals, the return address and the saved
+**     values of THIS and THAT if it changes them
+** Parameters:
+**     - function: Function to size the frame of
+** Pre-Conditions: function is non-null
+** Post-Conditions: N/A
+*******************************************************************************/
+static unsigned get_frame_words(const vm_function *function) {
+    return function->num_args + function->num_locals + 1
+            + function->sets_this + function->sets_that;
+}
+
+/*******************************************************************************
+** Function: append_string
+** Description: Appends a copy of string to a growable array of strings
+** Parameters:
+**     - strings: Array to append to
+**     - num_strings: Number of strings in the array
+**     - capacity: Number of strings the array has room for
+**     - string: String to copy
+** Pre-Conditions: All parameters are non-null
+** Post-Conditions: *num_strings has been incremented
+*******************************************************************************/
+static void append_string(char ***strings, unsigned *num_strings,
+        unsigned *capacity, const char *string) {
+    if (*num_strings == *capacity) {
+        *strings = grow(*strings, capacity, sizeof(char *));
+    }
+    (*strings)[(*num_strings)++] = safe_strdup(string);
+}
+
+/*******************************************************************************
+** Function: grow
+** Description: Doubles the capacity of a growable array
+** Parameters:
+**     - array: Array to grow, or NULL if nothing has been allocated yet
+**     - capacity: Number of elements the array has room for
+**     - element_size: Size of each element in bytes
+** Pre-Conditions: capacity is non-null
+** Post-Conditions: Return value is non-null
+*******************************************************************************/
+static void *grow(void *array, unsigned *capacity, size_t element_size) {
+    *capacity = *capacity ? *capacity * 2 : INITIAL_CAPACITY;
+    array = realloc(array, *capacity * element_size);
+    assert_nonnull(array, "Error allocating memory");
+    return array;
+}
@@ -0,0 +1,61 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdbool.h>
+
+#include "hash_table.h"
+
+// one call command
+typedef struct {
+    char *callee;
+    unsigned num_args;
+} vm_call;
+
+// one vm function, or the code of a file that precedes its first function
+typedef struct {
+    char *name;             // NULL for code outside any function
+    unsigned file_index;    // file the function was read from
+    char **lines;
+    unsigned num_lines;
+    unsigned lines_capacity;
+    vm_call *calls;         // calls made, in order
+    unsigned num_calls;
+    unsigned calls_capacity;
+    unsigned num_args;      // most arguments any call passes it
+    unsigned num_locals;
+    bool sets_this;         // pops to pointer 0
+    bool sets_that;         // pops to pointer 1
+    bool reachable;
+    // set by program_assign_static_frames for functions that cannot be
+    // active more than once at a time; their arguments, locals, return
+    // address and any THIS/THAT they change are kept at fixed addresses
+    bool has_static_frame;
+    unsigned frame_base;
+    // set by program_mark_inlined for functions with a static frame whose body
+    // is written in place of every call to them
+    bool inlined;
+} vm_function;
+
+// every vm file of a translation, read into memory as a list of functions
+typedef struct {
+    char **file_names;
+    unsigned num_files;
+    unsigned files_capacity;
+    vm_function *functions;
+    unsigned num_functions;
+    unsigned functions_capacity;
+    hash_table *function_indices;
+} vm_program;
+
+vm_program *program_init();
+void program_add_file(vm_program *program, const char *vm_file_path,
+        const char *vm_file_name);
+vm_function *program_find_function(const vm_program *program,
+        const char *name);
+unsigned program_mark_reachable(vm_program *program, const char *root_name);
+unsigned program_assign_static_frames(vm_program *program,
+        unsigned frames_start, unsigned max_frame_words);
+unsigned program_mark_inlined(vm_program *program, unsigned max_commands);
+void program_dispose(vm_program *program);
+
+#endif